@@ -8,592 +8,6423 @@
 #include "ns3/config-store-module.h"
 #include "ns3/energy-module.h"
 #include "ns3/internet-module.h"
+#include "ns3/default-simulator-impl.h"
 
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <string>
+#include <map>
+#include <functional>
+#include <sstream>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <cctype>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <typeindex>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <new>
+#include <set>
+#include <typeinfo>
+#include <iomanip>
+#include <iterator>
+#include <limits>
+#include <cxxabi.h>
+#include <execinfo.h>
+#if defined (__x86_64__) || defined (__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 
 using namespace ns3;
 
 NS_LOG_COMPONENT_DEFINE ("Main");
 
-class Experiment
+/** Cached log distance channel **/
+/***************************************************************************/
+
+/// Distances from (px, py, pz) to n packed positions, computed as CalculateDistance does.
+static void
+CalcDistancesScalar (const double *x, const double *y, const double *z, double px, double py, double pz,
+                     double *distances, uint32_t n)
+{
+  for (uint32_t i = 0; i < n; i++)
+    {
+      double dx = x[i] - px;
+      double dy = y[i] - py;
+      double dz = z[i] - pz;
+      distances[i] = std::sqrt (dx * dx + dy * dy + dz * dz);
+    }
+}
+
+#if defined (__x86_64__) || defined (__i386__)
+/// CalcDistancesScalar four receivers at a time; sqrt is correctly rounded in both.
+__attribute__ ((target ("avx2")))
+static void
+CalcDistancesAvx2 (const double *x, const double *y, const double *z, double px, double py, double pz,
+                   double *distances, uint32_t n)
+{
+  __m256d vpx = _mm256_set1_pd (px);
+  __m256d vpy = _mm256_set1_pd (py);
+  __m256d vpz = _mm256_set1_pd (pz);
+  uint32_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    {
+      __m256d dx = _mm256_sub_pd (_mm256_loadu_pd (x + i), vpx);
+      __m256d dy = _mm256_sub_pd (_mm256_loadu_pd (y + i), vpy);
+      __m256d dz = _mm256_sub_pd (_mm256_loadu_pd (z + i), vpz);
+      __m256d sum = _mm256_add_pd (_mm256_add_pd (_mm256_mul_pd (dx, dx), _mm256_mul_pd (dy, dy)),
+                                   _mm256_mul_pd (dz, dz));
+      _mm256_storeu_pd (distances + i, _mm256_sqrt_pd (sum));
+    }
+  CalcDistancesScalar (x + i, y + i, z + i, px, py, pz, distances + i, n - i);
+}
+#endif
+
+static void
+CalcDistances (const double *x, const double *y, const double *z, double px, double py, double pz,
+               double *distances, uint32_t n)
+{
+#if defined (__x86_64__) || defined (__i386__)
+  static const bool avx2 = __builtin_cpu_supports ("avx2");
+  if (avx2)
+    {
+      CalcDistancesAvx2 (x, y, z, px, py, pz, distances, n);
+      return;
+    }
+#endif
+  CalcDistancesScalar (x, y, z, px, py, pz, distances, n);
+}
+
+/**
+ * Log distance loss model caching the loss between pairs of nodes at rest.
+ *
+ * Positions are kept in packed arrays updated from the CourseChange trace.
+ * The first time a node at rest transmits, its loss to every known node is
+ * computed in one batch over those arrays and kept as a row; a course
+ * change clears the row of the node and recomputes its column in the other
+ * rows.  Pairs with a node moving at non-zero velocity are computed from the
+ * current positions.  The arithmetic is that of
+ * LogDistancePropagationLossModel, so results are bit-identical to it;
+ * with Verify set every result is compared with that model's.  Rows take
+ * 8 bytes per node; at most MaxRows are kept at a time.  Nodes are indexed
+ * through a hash map, and the transmitter's index is kept between calls.
+ */
+class CachedLogDistancePropagationLossModel : public PropagationLossModel
 {
 public:
-  Experiment ();
-  Experiment (std::string name);
-  Gnuplot2dDataset Run (const WifiHelper &wifi, const YansWifiPhyHelper &wifiPhy,
-                        const WifiMacHelper &wifiMac, const YansWifiChannelHelper &wifiChannel);
-private:
-  void ReceivePacket (Ptr<Socket> socket);
-  void SetPosition (Ptr<Node> node, Vector position);
-  Vector GetPosition (Ptr<Node> node);
-  void AdvancePosition (Ptr<Node> node);
-  Ptr<Socket> SetupPacketReceive (Ptr<Node> node);
+  static TypeId GetTypeId (void);
+  CachedLogDistancePropagationLossModel ();
 
-  uint32_t m_bytesTotal;
-  Gnuplot2dDataset m_output;
+protected:
+  virtual void DoDispose (void);
+
+private:
+  virtual double DoCalcRxPower (double txPowerDbm, Ptr<MobilityModel> a, Ptr<MobilityModel> b) const;
+  virtual int64_t DoAssignStreams (int64_t stream);
+  /// Gain in dB, negative, at the given distance.
+  double CalcGain (double distance) const;
+  uint32_t Lookup (Ptr<MobilityModel> model) const;
+  void Store (uint32_t index, Ptr<const MobilityModel> model) const;
+  void CourseChanged (Ptr<const MobilityModel> model);
+  /// Row of gains from a transmitter, completed for the nodes added since it was computed.
+  const std::vector<double> &GetRow (uint32_t index) const;
+
+  double m_exponent;
+  double m_referenceDistance;
+  double m_referenceLoss;
+  uint32_t m_maxRows;
+  bool m_verify;
+  mutable Ptr<LogDistancePropagationLossModel> m_reference;   ///< for Verify
+  mutable std::unordered_map<const MobilityModel *, uint32_t> m_indices;
+  mutable const MobilityModel *m_lastModel;   ///< transmitter of the previous call
+  mutable uint32_t m_lastIndex;
+  mutable std::vector<double> m_x;
+  mutable std::vector<double> m_y;
+  mutable std::vector<double> m_z;
+  mutable std::vector<uint8_t> m_moving;
+  mutable std::vector<std::vector<double> > m_rows;   ///< gains from each node, empty if not computed
+  mutable uint32_t m_rowCount;                        ///< non-empty rows
 };
 
-Experiment::Experiment ()
+NS_OBJECT_ENSURE_REGISTERED (CachedLogDistancePropagationLossModel);
+
+TypeId
+CachedLogDistancePropagationLossModel::GetTypeId (void)
 {
+  static TypeId tid = TypeId ("ns3::CachedLogDistancePropagationLossModel")
+    .SetParent<PropagationLossModel> ()
+    .AddConstructor<CachedLogDistancePropagationLossModel> ()
+    .AddAttribute ("Exponent", "The exponent of the Path Loss propagation model.",
+                   DoubleValue (3.0),
+                   MakeDoubleAccessor (&CachedLogDistancePropagationLossModel::m_exponent),
+                   MakeDoubleChecker<double> ())
+    .AddAttribute ("ReferenceDistance", "The distance at which the reference loss is calculated (m).",
+                   DoubleValue (1.0),
+                   MakeDoubleAccessor (&CachedLogDistancePropagationLossModel::m_referenceDistance),
+                   MakeDoubleChecker<double> ())
+    .AddAttribute ("ReferenceLoss", "The reference loss at reference distance (dB).",
+                   DoubleValue (46.6777),
+                   MakeDoubleAccessor (&CachedLogDistancePropagationLossModel::m_referenceLoss),
+                   MakeDoubleChecker<double> ())
+    .AddAttribute ("MaxRows", "The number of transmitter rows kept before the cache is flushed.",
+                   UintegerValue (1024),
+                   MakeUintegerAccessor (&CachedLogDistancePropagationLossModel::m_maxRows),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("Verify", "Abort unless every result equals that of LogDistancePropagationLossModel bit for bit.",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&CachedLogDistancePropagationLossModel::m_verify),
+                   MakeBooleanChecker ())
+  ;
+  return tid;
 }
 
-Experiment::Experiment (std::string name)
-  : m_output (name)
+CachedLogDistancePropagationLossModel::CachedLogDistancePropagationLossModel ()
+  : m_verify (false),
+    m_lastModel (0),
+    m_lastIndex (0),
+    m_rowCount (0)
 {
-  m_output.SetStyle (Gnuplot2dDataset::LINES);
 }
 
 void
-Experiment::SetPosition (Ptr<Node> node, Vector position)
+CachedLogDistancePropagationLossModel::DoDispose (void)
 {
-  Ptr<MobilityModel> mobility = node->GetObject<MobilityModel> ();
-  mobility->SetPosition (position);
+  m_reference = 0;
+  m_indices.clear ();
+  m_lastModel = 0;
+  m_rows.clear ();
+  PropagationLossModel::DoDispose ();
 }
 
-Vector
-Experiment::GetPosition (Ptr<Node> node)
+double
+CachedLogDistancePropagationLossModel::CalcGain (double distance) const
 {
-  Ptr<MobilityModel> mobility = node->GetObject<MobilityModel> ();
-  return mobility->GetPosition ();
+  if (distance <= m_referenceDistance)
+    {
+      return -m_referenceLoss;
+    }
+  double pathLossDb = 10 * m_exponent * std::log10 (distance / m_referenceDistance);
+  return -m_referenceLoss - pathLossDb;
 }
 
-void 
-Experiment::AdvancePosition (Ptr<Node> node) 
+void
+CachedLogDistancePropagationLossModel::Store (uint32_t index, Ptr<const MobilityModel> model) const
 {
-  Vector pos = GetPosition (node);
-  double mbs = ((m_bytesTotal * 8.0) / 1000000);
-  m_bytesTotal = 0;
-  m_output.Add (pos.x, mbs);
-  m_output.Add (pos.y, mbs);
-  pos.x += 1.0;
-  pos.y += 2.0;
-  if (pos.x >= 600.0) 
-    {
-      return;
-    }
-  if (pos.y >= 900.0) 
+  Vector position = model->GetPosition ();
+  Vector velocity = model->GetVelocity ();
+  m_x[index] = position.x;
+  m_y[index] = position.y;
+  m_z[index] = position.z;
+  m_moving[index] = velocity.x != 0.0 || velocity.y != 0.0 || velocity.z != 0.0;
+}
+
+uint32_t
+CachedLogDistancePropagationLossModel::Lookup (Ptr<MobilityModel> model) const
+{
+  std::unordered_map<const MobilityModel *, uint32_t>::const_iterator i = m_indices.find (PeekPointer (model));
+  if (i != m_indices.end ())
     {
-      return;
+      return i->second;
     }
-  SetPosition (node, pos);
-  //std::cout << "x="<<pos.x << std::endl;
-  Simulator::Schedule (Seconds (1.5), &Experiment::AdvancePosition, this, node);
+  uint32_t index = m_x.size ();
+  m_indices[PeekPointer (model)] = index;
+  m_x.push_back (0.0);
+  m_y.push_back (0.0);
+  m_z.push_back (0.0);
+  m_moving.push_back (0);
+  m_rows.push_back (std::vector<double> ());
+  Store (index, model);
+  model->TraceConnectWithoutContext ("CourseChange",
+                                     MakeCallback (&CachedLogDistancePropagationLossModel::CourseChanged,
+                                                   const_cast<CachedLogDistancePropagationLossModel *> (this)));
+  return index;
 }
 
 void
-Experiment::ReceivePacket (Ptr<Socket> socket)
+CachedLogDistancePropagationLossModel::CourseChanged (Ptr<const MobilityModel> model)
 {
-  Ptr<Packet> packet;
-  while ((packet = socket->Recv ()))
+  uint32_t index = m_indices[PeekPointer (model)];
+  Store (index, model);
+  if (!m_rows[index].empty ())
+    {
+      m_rows[index].clear ();
+      m_rowCount--;
+    }
+  for (uint32_t i = 0; i < m_rows.size (); i++)
     {
-      m_bytesTotal += packet->GetSize ();
+      std::vector<double> &row = m_rows[i];
+      if (index < row.size ())
+        {
+          double distance;
+          CalcDistancesScalar (&m_x[index], &m_y[index], &m_z[index], m_x[i], m_y[i], m_z[i], &distance, 1);
+          row[index] = CalcGain (distance);
+        }
     }
 }
 
-Ptr<Socket>
-Experiment::SetupPacketReceive (Ptr<Node> node)
-{
-  TypeId tid = TypeId::LookupByName ("ns3::PacketSocketFactory");
-  Ptr<Socket> sink = Socket::CreateSocket (node, tid);
-  sink->Bind ();
-  sink->SetRecvCallback (MakeCallback (&Experiment::ReceivePacket, this));
-  return sink;
-}
-/// Trace function for remaining energy at node.
-void
-RemainingEnergy (double oldValue, double remainingEnergy)
+const std::vector<double> &
+CachedLogDistancePropagationLossModel::GetRow (uint32_t index) const
 {
-  NS_LOG_UNCOND (Simulator::Now ().GetSeconds ()
-                 << "s Current remaining energy = " << remainingEnergy << "J");
+  std::vector<double> &row = m_rows[index];
+  uint32_t start = row.size ();
+  uint32_t n = m_x.size ();
+  if (start == n)
+    {
+      return row;
+    }
+  if (start == 0)
+    {
+      if (m_rowCount == m_maxRows)
+        {
+          for (uint32_t i = 0; i < m_rows.size (); i++)
+            {
+              std::vector<double> ().swap (m_rows[i]);
+            }
+          m_rowCount = 0;
+        }
+      m_rowCount++;
+    }
+  row.resize (n);
+  CalcDistances (&m_x[start], &m_y[start], &m_z[start], m_x[index], m_y[index], m_z[index], &row[start], n - start);
+  for (uint32_t i = start; i < n; i++)
+    {
+      row[i] = CalcGain (row[i]);
+    }
+  return row;
 }
 
-/// Trace function for total energy consumption at node.
-void
-TotalEnergy (double oldValue, double totalEnergy)
+double
+CachedLogDistancePropagationLossModel::DoCalcRxPower (double txPowerDbm, Ptr<MobilityModel> a,
+                                                      Ptr<MobilityModel> b) const
 {
-  NS_LOG_UNCOND (Simulator::Now ().GetSeconds ()
-                 << "s Total energy consumed by node = " << totalEnergy << "J");
+  // the channel computes the loss from one transmitter to every receiver in turn
+  if (PeekPointer (a) != m_lastModel)
+    {
+      m_lastIndex = Lookup (a);
+      m_lastModel = PeekPointer (a);
+    }
+  uint32_t ia = m_lastIndex;
+  uint32_t ib = Lookup (b);
+  double rxPowerDbm;
+  if (m_moving[ia] || m_moving[ib])
+    {
+      rxPowerDbm = txPowerDbm + CalcGain (a->GetDistanceFrom (b));
+    }
+  else
+    {
+      rxPowerDbm = txPowerDbm + GetRow (ia)[ib];
+    }
+  if (m_verify)
+    {
+      if (m_reference == 0)
+        {
+          m_reference = CreateObject<LogDistancePropagationLossModel> ();
+          m_reference->SetAttribute ("Exponent", DoubleValue (m_exponent));
+          m_reference->SetAttribute ("ReferenceDistance", DoubleValue (m_referenceDistance));
+          m_reference->SetAttribute ("ReferenceLoss", DoubleValue (m_referenceLoss));
+        }
+      double expected = m_reference->CalcRxPower (txPowerDbm, a, b);
+      NS_ABORT_MSG_IF (std::memcmp (&rxPowerDbm, &expected, sizeof (double)) != 0,
+                       "Cached loss " << rxPowerDbm << " dBm differs from " << expected << " dBm");
+    }
+  return rxPowerDbm;
 }
 
-//****
-
-Gnuplot2dDataset
-Experiment::Run (const WifiHelper &wifi, const YansWifiPhyHelper &wifiPhy,
-                 const WifiMacHelper &wifiMac, const YansWifiChannelHelper &wifiChannel)
+int64_t
+CachedLogDistancePropagationLossModel::DoAssignStreams (int64_t stream)
 {
-  m_bytesTotal = 0;
+  return 0;
+}
 
-  NodeContainer c;
-  c.Create (16);
+/***************************************************************************/
 
-  PacketSocketHelper packetSocket;
-  packetSocket.Install (c);
+/** Tabulated error rates **/
+/***************************************************************************/
 
-  YansWifiPhyHelper phy = wifiPhy;
-  phy.SetChannel (wifiChannel.Create ());
+/**
+ * Error rate model reading chunk success rates from per-mode tables.
+ *
+ * The Inner model must give chunk success rates of the form (1 - p)^nbits,
+ * p being the bit error probability of the mode at the given SNR, as the
+ * NIST and YANS models do, and p must not depend on the TxVector.  For each
+ * mode the table holds y = ln (-ln (1 - p)) every StepDb over
+ * [MinSnrDb, MaxSnrDb], which varies smoothly enough for linear
+ * interpolation.  A chunk succeeds with exp (-nbits e^y), so the largest
+ * error over every chunk length for a given error on y has a closed form.
+ * The step is halved until, halfway between entries, no chunk of 1 to
+ * MaxBits bits is further than MaxError from Inner; longer chunks, modes
+ * that never get there and SNRs off the grid are computed by Inner.  The
+ * error is checked at the midpoints only, where it peaks for a smooth y,
+ * so MaxError is a close but not a strict bound.
+ *
+ * Tables are shared by every instance in the process with the same Inner
+ * type and grid attributes, so that the error models of all the PHYs build
+ * each table once.
+ */
+class TabulatedErrorRateModel : public ErrorRateModel
+{
+public:
+  static TypeId GetTypeId (void);
+  TabulatedErrorRateModel ();
 
-  WifiMacHelper mac = wifiMac;
-  NetDeviceContainer devices = wifi.Install (phy, mac, c);
+  virtual double GetChunkSuccessRate (WifiMode mode, WifiTxVector txVector, double snr, uint64_t nbits) const;
+private:
+  /// Table of one mode.
+  struct Table
+  {
+    double step;              ///< dB between entries, 0 if Inner computes the mode
+    std::vector<double> y;    ///< ln (-ln (1 - p)) at MinSnrDb + i * step
+  };
+
+  Ptr<ErrorRateModel> GetInner (void) const;
+  /// ln (-ln (1 - p)) of Inner, clamped to finite values.
+  double CalcY (WifiMode mode, WifiTxVector txVector, double snrDb) const;
+  /// Interpolated y of the table, false when snrDb is off the grid.
+  bool Interpolate (const Table &table, double snrDb, double &y) const;
+  const Table &GetTable (WifiMode mode, WifiTxVector txVector) const;
+  void BuildTable (WifiMode mode, WifiTxVector txVector, Table &table) const;
+
+  /// Largest difference between exp (-n e^y1) and exp (-n e^y2) for n in [1, maxBits].
+  static double CalcChunkError (double y1, double y2, double maxBits);
+
+  /// Inner type name, MinSnrDb, MaxSnrDb, StepDb, MaxError, MaxRefinements, MaxBits and WifiMode uid of a table.
+  typedef std::tuple<std::string, double, double, double, double, uint32_t, uint64_t, uint32_t> TableKey;
+  /// Tables of every instance in the process; entries never move.
+  static std::map<TableKey, Table> g_tables;
+
+  TypeId m_innerType;
+  double m_minSnrDb;
+  double m_maxSnrDb;
+  double m_stepDb;
+  double m_maxError;
+  uint32_t m_maxRefinements;
+  uint64_t m_maxBits;
+  mutable Ptr<ErrorRateModel> m_inner;
+  mutable std::map<uint32_t, const Table *> m_tables;   ///< entries of g_tables used so far, by WifiMode uid
+};
 
-  NS_LOG_INFO ("Enabling OLSR routing on all backbone nodes");
-  OlsrHelper olsr;
-  
+std::map<TabulatedErrorRateModel::TableKey, TabulatedErrorRateModel::Table> TabulatedErrorRateModel::g_tables;
 
-  MobilityHelper mobility;
- /* mobility.SetPositionAllocator ("ns3::GridPositionAllocator",
-                                 "MinX", DoubleValue (20.0),
-                                 "MinY", DoubleValue (20.0),
-                                 "DeltaX", DoubleValue (20.0),
-                                 "DeltaY", DoubleValue (20.0),
-                                 "GridWidth", UintegerValue (5),
-                                 "LayoutType", StringValue ("RowFirst"));
-  mobility.SetMobilityModel ("ns3::RandomDirection2dMobilityModel",
-                             "Bounds", RectangleValue (Rectangle (-500, 500, -500, 500)),
-                             "Speed", StringValue ("ns3::ConstantRandomVariable[Constant=2]"),
-                             "Pause", StringValue ("ns3::ConstantRandomVariable[Constant=0.2]"));
-  mobility.Install (c);
-*/
-  Ptr<ListPositionAllocator> positionAlloc = CreateObject<ListPositionAllocator> ();
+NS_OBJECT_ENSURE_REGISTERED (TabulatedErrorRateModel);
 
-  positionAlloc->Add (Vector (100.0, 0.0, 0.0));//node 0(mobile)
-  positionAlloc->Add (Vector (90.0, 10.0, 0.0));//node1 e1
-  positionAlloc->Add (Vector (110.0, 10.0, 0.0));//node2 e2
-  positionAlloc->Add (Vector (115.0, -10.0, 0.0));//node3 e3
-  positionAlloc->Add (Vector (100.0, -10.0, 0.0));//node4 e4
-  positionAlloc->Add (Vector (90.0, -10.0, 0.0));//node5 e5
-
-  positionAlloc->Add (Vector (75.0, -35.0, 0.0));//node6
-  positionAlloc->Add (Vector (95.0, -30.0, 0.0));//node7
-  positionAlloc->Add (Vector (105.0, -25.0, 0.0));//node8
-  positionAlloc->Add (Vector (85.0, -10.0, 0.0));//node9
-positionAlloc->Add (Vector (70.0, 0.0, 0.0));//node10
-positionAlloc->Add (Vector (55.0, -10.0, 0.0));//node11
-positionAlloc->Add (Vector (60.0, -20.0, 0.0));//node12
-positionAlloc->Add (Vector (110.0, -30.0, 0.0));//node13
-positionAlloc->Add (Vector (95.0, -40.0, 0.0));//node14
-positionAlloc->Add (Vector (85.0,-30.0, 0.0));//node15
-/*positionAlloc->Add (Vector (17.0, 0.0, 0.0));//node16
-positionAlloc->Add (Vector (0.0, 2.0, 0.0));//node17
-positionAlloc->Add (Vector (5.0, 0.0, 0.0));//node18
-positionAlloc->Add (Vector (0.0, 16.0, 0.0));//node19*/
+TypeId
+TabulatedErrorRateModel::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::TabulatedErrorRateModel")
+    .SetParent<ErrorRateModel> ()
+    .AddConstructor<TabulatedErrorRateModel> ()
+    .AddAttribute ("Inner", "The error rate model that is tabulated.",
+                   TypeIdValue (NistErrorRateModel::GetTypeId ()),
+                   MakeTypeIdAccessor (&TabulatedErrorRateModel::m_innerType),
+                   MakeTypeIdChecker ())
+    .AddAttribute ("MinSnrDb", "The lowest SNR (dB) of the tables.",
+                   DoubleValue (-10.0),
+                   MakeDoubleAccessor (&TabulatedErrorRateModel::m_minSnrDb),
+                   MakeDoubleChecker<double> ())
+    .AddAttribute ("MaxSnrDb", "The highest SNR (dB) of the tables.",
+                   DoubleValue (40.0),
+                   MakeDoubleAccessor (&TabulatedErrorRateModel::m_maxSnrDb),
+                   MakeDoubleChecker<double> ())
+    .AddAttribute ("StepDb", "The initial SNR step (dB) between table entries.",
+                   DoubleValue (0.05),
+                   MakeDoubleAccessor (&TabulatedErrorRateModel::m_stepDb),
+                   MakeDoubleChecker<double> (1e-6))
+    .AddAttribute ("MaxError", "The largest absolute error allowed on a chunk success rate.",
+                   DoubleValue (1e-4),
+                   MakeDoubleAccessor (&TabulatedErrorRateModel::m_maxError),
+                   MakeDoubleChecker<double> (0.0))
+    .AddAttribute ("MaxRefinements", "The number of times the step of a table may be halved.",
+                   UintegerValue (6),
+                   MakeUintegerAccessor (&TabulatedErrorRateModel::m_maxRefinements),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("MaxBits", "The longest chunk (bits) read from the tables; longer chunks are computed by Inner.",
+                   UintegerValue (1 << 23),
+                   MakeUintegerAccessor (&TabulatedErrorRateModel::m_maxBits),
+                   MakeUintegerChecker<uint64_t> (1))
+  ;
+  return tid;
+}
 
-  mobility.SetPositionAllocator (positionAlloc);
-  mobility.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
+TabulatedErrorRateModel::TabulatedErrorRateModel ()
+{
+}
 
-  mobility.Install (c);
+Ptr<ErrorRateModel>
+TabulatedErrorRateModel::GetInner (void) const
+{
+  if (m_inner == 0)
+    {
+      ObjectFactory factory;
+      factory.SetTypeId (m_innerType);
+      m_inner = factory.Create<ErrorRateModel> ();
+    }
+  return m_inner;
+}
 
- /** Energy Model **/
-  /***************************************************************************/
-  /* energy source */
-  BasicEnergySourceHelper basicSourceHelper;
-  // configure energy source
-  basicSourceHelper.Set ("BasicEnergySourceInitialEnergyJ", DoubleValue (100.0));
-  // install source
-  EnergySourceContainer sources = basicSourceHelper.Install (c);
-  /* device energy model */
-  WifiRadioEnergyModelHelper radioEnergyHelper;
-  // configure radio energy model
-  radioEnergyHelper.Set ("TxCurrentA", DoubleValue (0.000001));
-  // install device model
-  DeviceEnergyModelContainer deviceModels = radioEnergyHelper.Install (devices, sources);
-  /***************************************************************************/
+double
+TabulatedErrorRateModel::CalcY (WifiMode mode, WifiTxVector txVector, double snrDb) const
+{
+  double snr = std::pow (10.0, snrDb / 10.0);
+  double logSuccess = std::log (GetInner ()->GetChunkSuccessRate (mode, txVector, snr, 1));
+  if (logSuccess > -1e-6)
+    {
+      // 1 - p rounds small p away: read it off a long chunk instead
+      const uint64_t bits = 1 << 20;
+      logSuccess = std::log (GetInner ()->GetChunkSuccessRate (mode, txVector, snr, bits)) / bits;
+    }
+  return std::max (-700.0, std::min (700.0, std::log (-logSuccess)));
+}
 
- 
-//****
-  PacketSocketAddress socket;
-  socket.SetSingleDevice (devices.Get (1)->GetIfIndex ());
-  socket.SetSingleDevice (devices.Get (2)->GetIfIndex ());
-  socket.SetSingleDevice (devices.Get (3)->GetIfIndex ());
-  socket.SetSingleDevice (devices.Get (4)->GetIfIndex ());
-  socket.SetSingleDevice (devices.Get (5)->GetIfIndex ());
-  socket.SetSingleDevice (devices.Get (6)->GetIfIndex ());
-  socket.SetSingleDevice (devices.Get (7)->GetIfIndex ());
-  socket.SetSingleDevice (devices.Get (8)->GetIfIndex ());
-  socket.SetSingleDevice (devices.Get (9)->GetIfIndex ());
-
-socket.SetSingleDevice (devices.Get (10)->GetIfIndex ());
-socket.SetSingleDevice (devices.Get (11)->GetIfIndex ());
-socket.SetSingleDevice (devices.Get (12)->GetIfIndex ());
-socket.SetSingleDevice (devices.Get (13)->GetIfIndex ());
-socket.SetSingleDevice (devices.Get (14)->GetIfIndex ());
-socket.SetSingleDevice (devices.Get (15)->GetIfIndex ());
-/*socket.SetSingleDevice (devices.Get (1)->GetIfIndex ());
-socket.SetSingleDevice (devices.Get (17)->GetIfIndex ());
-socket.SetSingleDevice (devices.Get (18)->GetIfIndex ());
-socket.SetSingleDevice (devices.Get (19)->GetIfIndex ());*/
-
-  socket.SetPhysicalAddress (devices.Get (1)->GetAddress ());
-  socket.SetProtocol (1);
-
-  socket.SetPhysicalAddress (devices.Get (2)->GetAddress ());
-  socket.SetProtocol (2);
-
-  socket.SetPhysicalAddress (devices.Get (3)->GetAddress ());
-  socket.SetProtocol (3);
-
-  socket.SetPhysicalAddress (devices.Get (4)->GetAddress ());
-  socket.SetProtocol (4);
-
-  socket.SetPhysicalAddress (devices.Get (0)->GetAddress ());
-  socket.SetProtocol (0);
-
-
-
-  OnOffHelper onoff ("ns3::PacketSocketFactory", Address (socket));
-  onoff.SetConstantRate (DataRate (6000));
-  onoff.SetAttribute ("PacketSize", UintegerValue (200));
-//data transfer start
-  ApplicationContainer apps = onoff.Install (c.Get (1));
+bool
+TabulatedErrorRateModel::Interpolate (const Table &table, double snrDb, double &y) const
+{
+  double x = (snrDb - m_minSnrDb) / table.step;
+  if (!(x >= 0.0) || x >= table.y.size () - 1)
+    {
+      return false;
+    }
+  uint32_t i = static_cast<uint32_t> (x);
+  y = table.y[i] + (x - i) * (table.y[i + 1] - table.y[i]);
+  return true;
+}
 
-  apps.Start (Seconds (0.5));
-  apps.Stop (Seconds (250.0));
+const TabulatedErrorRateModel::Table &
+TabulatedErrorRateModel::GetTable (WifiMode mode, WifiTxVector txVector) const
+{
+  std::map<uint32_t, const Table *>::iterator i = m_tables.find (mode.GetUid ());
+  if (i != m_tables.end ())
+    {
+      return *i->second;
+    }
+  TableKey key (m_innerType.GetName (), m_minSnrDb, m_maxSnrDb, m_stepDb, m_maxError, m_maxRefinements,
+                m_maxBits, mode.GetUid ());
+  std::map<TableKey, Table>::iterator shared = g_tables.find (key);
+  if (shared == g_tables.end ())
+    {
+      shared = g_tables.insert (std::make_pair (key, Table ())).first;
+      BuildTable (mode, txVector, shared->second);
+    }
+  m_tables[mode.GetUid ()] = &shared->second;
+  return shared->second;
+}
 
-ApplicationContainer apps1 = onoff.Install (c.Get (2));
+double
+TabulatedErrorRateModel::CalcChunkError (double y1, double y2, double maxBits)
+{
+  double low = std::min (y1, y2);
+  double high = std::max (y1, y2);
+  double a = std::exp (low);
+  double b = std::exp (high);
+  if (!(b > a))
+    {
+      return 0.0;
+    }
+  // exp (-n a) - exp (-n b) grows with n up to n = (high - low) / (b - a), then falls
+  double n = std::max (1.0, std::min (maxBits, (high - low) / (b - a)));
+  return -std::exp (-n * a) * std::expm1 (-n * (b - a));
+}
 
-  apps1.Start (Seconds (0.10));
-  apps1.Stop (Seconds (250.0));
+void
+TabulatedErrorRateModel::BuildTable (WifiMode mode, WifiTxVector txVector, Table &table) const
+{
+  table.step = m_stepDb;
+  for (uint32_t refinement = 0; refinement <= m_maxRefinements; refinement++, table.step /= 2)
+    {
+      uint32_t n = static_cast<uint32_t> ((m_maxSnrDb - m_minSnrDb) / table.step) + 1;
+      table.y.resize (n);
+      for (uint32_t k = 0; k < n; k++)
+        {
+          table.y[k] = CalcY (mode, txVector, m_minSnrDb + k * table.step);
+        }
+      double error = 0.0;
+      for (uint32_t k = 0; k + 1 < n && error <= m_maxError; k++)
+        {
+          double y = (table.y[k] + table.y[k + 1]) / 2;
+          double exact = CalcY (mode, txVector, m_minSnrDb + (k + 0.5) * table.step);
+          error = std::max (error, CalcChunkError (y, exact, m_maxBits));
+        }
+      if (error <= m_maxError)
+        {
+          NS_LOG_DEBUG ("Tabulated " << mode.GetUniqueName () << " every " << table.step << " dB");
+          return;
+        }
+    }
+  NS_LOG_WARN ("Cannot tabulate " << mode.GetUniqueName () << " within " << m_maxError);
+  table.step = 0.0;
+  table.y.clear ();
+}
 
-ApplicationContainer apps2 = onoff.Install (c.Get (3));
+double
+TabulatedErrorRateModel::GetChunkSuccessRate (WifiMode mode, WifiTxVector txVector, double snr,
+                                              uint64_t nbits) const
+{
+  const Table &table = GetTable (mode, txVector);
+  double y;
+  if (table.step == 0.0 || nbits > m_maxBits || snr <= 0.0 || !Interpolate (table, 10.0 * std::log10 (snr), y))
+    {
+      return GetInner ()->GetChunkSuccessRate (mode, txVector, snr, nbits);
+    }
+  return std::exp (-(nbits * std::exp (y)));
+}
 
-  apps2.Start (Seconds (0.15));
-  apps2.Stop (Seconds (250.0));
+/***************************************************************************/
 
-ApplicationContainer apps3 = onoff.Install (c.Get (4));
+/** Binary trace sink **/
+/***************************************************************************/
 
-  apps3.Start (Seconds (0.10));
-  apps3.Stop (Seconds (250.0));
+/// Identifies the trace source of a record.
+enum TraceSourceId
+{
+  TRACE_REMAINING_ENERGY = 0,
+  TRACE_TOTAL_ENERGY = 1
+};
 
-ApplicationContainer apps4 = onoff.Install (c.Get (5));
+/// A fixed size binary trace record.
+struct TraceRecord
+{
+  int64_t time;               ///< simulation time in nanoseconds
+  uint32_t node;
+  uint32_t trace;             ///< TraceSourceId
+  double value;
+};
 
-  apps4.Start (Seconds (0.5));
-  apps4.Stop (Seconds (250.0));
+/**
+ * Single producer, single consumer ring of trace records.  The producer is
+ * the thread the ring belongs to, the consumer is the writer thread.
+ */
+class TraceRing
+{
+public:
+  /// \param capacity a power of two
+  explicit TraceRing (uint32_t capacity);
+  bool Push (const TraceRecord &record);
+  bool Pop (TraceRecord &record);
+  uint32_t GetSize (void) const;
+  uint32_t GetCapacity (void) const;
+private:
+  std::vector<TraceRecord> m_records;
+  uint64_t m_mask;
+  std::atomic<uint64_t> m_head;   ///< next record to pop
+  std::atomic<uint64_t> m_tail;   ///< next record to push
+};
 
-ApplicationContainer apps5 = onoff.Install (c.Get (6));
+TraceRing::TraceRing (uint32_t capacity)
+  : m_records (capacity),
+    m_mask (capacity - 1),
+    m_head (0),
+    m_tail (0)
+{
+  NS_ASSERT ((capacity & (capacity - 1)) == 0);
+}
 
-  apps5.Start (Seconds (0.10));
-  apps5.Stop (Seconds (250.0));
+bool
+TraceRing::Push (const TraceRecord &record)
+{
+  uint64_t tail = m_tail.load (std::memory_order_relaxed);
+  if (tail - m_head.load (std::memory_order_acquire) == m_records.size ())
+    {
+      return false;
+    }
+  m_records[tail & m_mask] = record;
+  m_tail.store (tail + 1, std::memory_order_release);
+  return true;
+}
 
-ApplicationContainer apps6 = onoff.Install (c.Get (7));
+bool
+TraceRing::Pop (TraceRecord &record)
+{
+  uint64_t head = m_head.load (std::memory_order_relaxed);
+  if (head == m_tail.load (std::memory_order_acquire))
+    {
+      return false;
+    }
+  record = m_records[head & m_mask];
+  m_head.store (head + 1, std::memory_order_release);
+  return true;
+}
 
-  apps6.Start (Seconds (0.15));
-  apps6.Stop (Seconds (250.0));
+uint32_t
+TraceRing::GetSize (void) const
+{
+  return m_tail.load (std::memory_order_acquire) - m_head.load (std::memory_order_acquire);
+}
 
-ApplicationContainer apps7 = onoff.Install (c.Get (8));
+uint32_t
+TraceRing::GetCapacity (void) const
+{
+  return m_records.size ();
+}
 
-  apps7.Start (Seconds (0.5));
-  apps7.Stop (Seconds (250.0));
+/// Opening of a BinaryTraceSink that t_traceRing belongs to, 0 for none.
+static thread_local uint64_t t_traceGeneration = 0;
+/// Ring of the calling thread in the sink opened as t_traceGeneration.
+static thread_local TraceRing *t_traceRing = 0;
+
+/**
+ * Writes trace records to a columnar file from a background thread.
+ *
+ * Record () only copies the record into the ring of the calling thread, so
+ * the simulation never formats text or blocks on I/O.  The writer thread
+ * drains every ring into blocks of up to BLOCK_RECORDS records.
+ *
+ * File layout: the 8 byte magic "S2TRACE1", then blocks made of a uint32_t
+ * record count n followed by the n int64_t times, the n uint32_t nodes, the
+ * n uint32_t trace ids and the n double values.
+ */
+class BinaryTraceSink
+{
+public:
+  static const uint32_t RING_RECORDS = 1 << 16;
+  static const uint32_t BLOCK_RECORDS = 1 << 14;
+
+  BinaryTraceSink ();
+  ~BinaryTraceSink ();
+  void Open (std::string path);
+  void Close (void);
+  void Record (uint32_t node, TraceSourceId trace, double value);
+private:
+  TraceRing *GetRing (void);
+  void WriterLoop (void);
+  /// \return true if at least one record was moved from a ring to the block
+  bool Drain (void);
+  void WriteBlock (void);
+
+  std::ofstream m_file;
+  std::thread m_writer;
+  std::mutex m_mutex;                 ///< protects m_rings and m_stop
+  std::condition_variable m_wakeup;
+  std::vector<TraceRing *> m_rings;
+  bool m_stop;
+  /// Unique to each Open, so that a ring cached by a thread is never used past Close.
+  uint64_t m_generation;
+  std::vector<int64_t> m_times;       ///< columns of the block being filled
+  std::vector<uint32_t> m_nodes;
+  std::vector<uint32_t> m_traces;
+  std::vector<double> m_values;
+};
 
-ApplicationContainer apps8 = onoff.Install (c.Get (9));
+BinaryTraceSink::BinaryTraceSink ()
+  : m_stop (false),
+    m_generation (0)
+{
+}
 
-  apps8.Start (Seconds (0.10));
-  apps8.Stop (Seconds (250.0));
+BinaryTraceSink::~BinaryTraceSink ()
+{
+  Close ();
+}
 
-ApplicationContainer apps9 = onoff.Install (c.Get (10));
+void
+BinaryTraceSink::Open (std::string path)
+{
+  NS_ASSERT (!m_writer.joinable ());
+  m_file.open (path.c_str (), std::ios::binary | std::ios::trunc);
+  NS_ABORT_MSG_IF (!m_file, "Cannot create trace file " << path);
+  m_file.write ("S2TRACE1", 8);
+  m_stop = false;
+  // a sink closed and then reopened, or a new one at the address of an old one, gets new rings
+  static std::atomic<uint64_t> generations (0);
+  m_generation = ++generations;
+  m_writer = std::thread (&BinaryTraceSink::WriterLoop, this);
+}
 
-  apps9.Start (Seconds (0.15));
-  apps9.Stop (Seconds (250.0));
+void
+BinaryTraceSink::Close (void)
+{
+  if (!m_writer.joinable ())
+    {
+      return;
+    }
+  {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    m_stop = true;
+  }
+  m_wakeup.notify_one ();
+  m_writer.join ();
+  m_file.close ();
+  for (std::vector<TraceRing *>::iterator i = m_rings.begin (); i != m_rings.end (); ++i)
+    {
+      delete *i;
+    }
+  m_rings.clear ();
+  if (t_traceGeneration == m_generation)
+    {
+      t_traceGeneration = 0;
+      t_traceRing = 0;
+    }
+  m_generation = 0;
+}
 
-ApplicationContainer apps10 = onoff.Install (c.Get (11));
+TraceRing *
+BinaryTraceSink::GetRing (void)
+{
+  NS_ASSERT (m_generation != 0);
+  if (t_traceGeneration != m_generation)
+    {
+      t_traceRing = new TraceRing (RING_RECORDS);
+      t_traceGeneration = m_generation;
+      std::lock_guard<std::mutex> lock (m_mutex);
+      m_rings.push_back (t_traceRing);
+    }
+  return t_traceRing;
+}
 
-  apps10.Start (Seconds (0.5));
-  apps10.Stop (Seconds (250.0));
+void
+BinaryTraceSink::Record (uint32_t node, TraceSourceId trace, double value)
+{
+  TraceRecord record;
+  record.time = Simulator::Now ().GetNanoSeconds ();
+  record.node = node;
+  record.trace = trace;
+  record.value = value;
+  TraceRing *ring = GetRing ();
+  while (!ring->Push (record))
+    {
+      // the writer fell a full ring behind; give it the cpu
+      m_wakeup.notify_one ();
+      std::this_thread::yield ();
+    }
+  if (ring->GetSize () == ring->GetCapacity () / 2)
+    {
+      m_wakeup.notify_one ();
+    }
+}
 
-ApplicationContainer apps11 = onoff.Install (c.Get (12));
+bool
+BinaryTraceSink::Drain (void)
+{
+  std::vector<TraceRing *> rings;
+  {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    rings = m_rings;
+  }
+  bool drained = false;
+  TraceRecord record;
+  for (std::vector<TraceRing *>::iterator i = rings.begin (); i != rings.end (); ++i)
+    {
+      while ((*i)->Pop (record))
+        {
+          drained = true;
+          m_times.push_back (record.time);
+          m_nodes.push_back (record.node);
+          m_traces.push_back (record.trace);
+          m_values.push_back (record.value);
+          if (m_times.size () == BLOCK_RECORDS)
+            {
+              WriteBlock ();
+            }
+        }
+    }
+  return drained;
+}
 
-  apps11.Start (Seconds (0.10));
-  apps11.Stop (Seconds (250.0));
+void
+BinaryTraceSink::WriteBlock (void)
+{
+  uint32_t n = m_times.size ();
+  if (n == 0)
+    {
+      return;
+    }
+  m_file.write (reinterpret_cast<const char *> (&n), sizeof (n));
+  m_file.write (reinterpret_cast<const char *> (&m_times[0]), n * sizeof (m_times[0]));
+  m_file.write (reinterpret_cast<const char *> (&m_nodes[0]), n * sizeof (m_nodes[0]));
+  m_file.write (reinterpret_cast<const char *> (&m_traces[0]), n * sizeof (m_traces[0]));
+  m_file.write (reinterpret_cast<const char *> (&m_values[0]), n * sizeof (m_values[0]));
+  m_times.clear ();
+  m_nodes.clear ();
+  m_traces.clear ();
+  m_values.clear ();
+}
 
-ApplicationContainer apps12 = onoff.Install (c.Get (13));
+void
+BinaryTraceSink::WriterLoop (void)
+{
+  while (true)
+    {
+      bool stop;
+      {
+        std::unique_lock<std::mutex> lock (m_mutex);
+        m_wakeup.wait_for (lock, std::chrono::milliseconds (10));
+        stop = m_stop;
+      }
+      while (Drain ())
+        {
+        }
+      if (stop)
+        {
+          break;
+        }
+    }
+  WriteBlock ();
+  m_file.flush ();
+}
 
-  apps12.Start (Seconds (0.15));
-  apps12.Stop (Seconds (250.0));
+/// Trace function recording the remaining energy of a node into a binary sink.
+void
+RecordRemainingEnergy (BinaryTraceSink *sink, uint32_t node, double oldValue, double remainingEnergy)
+{
+  sink->Record (node, TRACE_REMAINING_ENERGY, remainingEnergy);
+}
 
-ApplicationContainer apps13 = onoff.Install (c.Get (14));
+/// Trace function recording the total energy consumed by a node into a binary sink.
+void
+RecordTotalEnergy (BinaryTraceSink *sink, uint32_t node, double oldValue, double totalEnergy)
+{
+  sink->Record (node, TRACE_TOTAL_ENERGY, totalEnergy);
+}
 
-  apps13.Start (Seconds (0.5));
-  apps13.Stop (Seconds (250.0));
+/**
+ * Converts a file written by BinaryTraceSink to CSV ("csv") or to one gnuplot
+ * dataset per node and trace source ("gnuplot") on the given stream.
+ */
+static void
+ConvertTraceFile (std::string path, std::string format, std::ostream &os)
+{
+  std::ifstream in (path.c_str (), std::ios::binary);
+  NS_ABORT_MSG_IF (!in, "Cannot open trace file " << path);
+  char magic[8];
+  in.read (magic, sizeof (magic));
+  NS_ABORT_MSG_IF (!in || std::memcmp (magic, "S2TRACE1", 8) != 0, path << " is not a trace file");
+  NS_ABORT_MSG_IF (format != "csv" && format != "gnuplot", "Unknown trace format " << format);
+  const char *names[] = { "RemainingEnergy", "TotalEnergyConsumption" };
+
+  std::map<std::pair<uint32_t, uint32_t>, Gnuplot2dDataset> series;
+  if (format == "csv")
+    {
+      os << "time,node,trace,value" << std::endl;
+    }
+  uint32_t n;
+  std::vector<int64_t> times;
+  std::vector<uint32_t> nodes;
+  std::vector<uint32_t> traces;
+  std::vector<double> values;
+  while (in.read (reinterpret_cast<char *> (&n), sizeof (n)))
+    {
+      times.resize (n);
+      nodes.resize (n);
+      traces.resize (n);
+      values.resize (n);
+      in.read (reinterpret_cast<char *> (&times[0]), n * sizeof (times[0]));
+      in.read (reinterpret_cast<char *> (&nodes[0]), n * sizeof (nodes[0]));
+      in.read (reinterpret_cast<char *> (&traces[0]), n * sizeof (traces[0]));
+      in.read (reinterpret_cast<char *> (&values[0]), n * sizeof (values[0]));
+      NS_ABORT_MSG_IF (!in, path << " ends in the middle of a block");
+      for (uint32_t i = 0; i < n; i++)
+        {
+          const char *name = traces[i] < 2 ? names[traces[i]] : "unknown";
+          if (format == "csv")
+            {
+              os << times[i] / 1e9 << "," << nodes[i] << "," << name << "," << values[i] << std::endl;
+              continue;
+            }
+          std::pair<uint32_t, uint32_t> key = std::make_pair (nodes[i], traces[i]);
+          std::map<std::pair<uint32_t, uint32_t>, Gnuplot2dDataset>::iterator j = series.find (key);
+          if (j == series.end ())
+            {
+              std::ostringstream title;
+              title << "node " << nodes[i] << " " << name;
+              j = series.insert (std::make_pair (key, Gnuplot2dDataset (title.str ()))).first;
+              j->second.SetStyle (Gnuplot2dDataset::LINES);
+            }
+          j->second.Add (times[i] / 1e9, values[i]);
+        }
+    }
+  if (format == "gnuplot")
+    {
+      Gnuplot gnuplot (path + ".png");
+      for (std::map<std::pair<uint32_t, uint32_t>, Gnuplot2dDataset>::const_iterator i = series.begin ();
+           i != series.end (); ++i)
+        {
+          gnuplot.AddDataset (i->second);
+        }
+      gnuplot.GenerateOutput (os);
+    }
+}
 
-ApplicationContainer apps14 = onoff.Install (c.Get (15));
+/***************************************************************************/
 
-  apps14.Start (Seconds (0.9));
-  apps14.Stop (Seconds (250.0));
+/** Scripted mobility **/
+/***************************************************************************/
 
-/*ApplicationContainer apps15 = onoff.Install (c.Get (16));
+/**
+ * Moves the scripted nodes of an Experiment: every Period each node steps by
+ * its velocity until it would reach XLimit or YLimit, where it stops.
+ *
+ * Nodes are grouped by the time of their first step.  A group keeps the
+ * positions and velocities of its nodes in contiguous arrays, advances all
+ * of them with one branch-free loop and one event per tick, and only calls
+ * SetPosition, which notifies the course change, for nodes that moved.
+ */
+class BatchedMobility
+{
+public:
+  BatchedMobility ();
+  void SetPeriod (Time period);
+  void SetLimits (double x, double y);
+  /// Adds a node at its current position, first stepping it at start.
+  void Add (Ptr<Node> node, Time start, Vector velocity);
+  /// Schedules the first step of every group.
+  void Start (void);
+  void Clear (void);
+private:
+  struct Group
+  {
+    Time start;
+    std::vector<Ptr<MobilityModel> > models;
+    std::vector<double> x, y, z;
+    std::vector<double> vx, vy, vz;
+    std::vector<uint8_t> active;
+    std::vector<uint8_t> moved;
+  };
+  void Step (uint32_t group);
+
+  Time m_period;
+  double m_xLimit;
+  double m_yLimit;
+  std::map<Time, uint32_t> m_groupOfStart;
+  std::vector<Group> m_groups;
+};
 
-  apps15.Start (Seconds (0.13));
-  apps15.Stop (Seconds (250.0));
+BatchedMobility::BatchedMobility ()
+  : m_period (Seconds (1.5)),
+    m_xLimit (600.0),
+    m_yLimit (900.0)
+{
+}
 
-ApplicationContainer apps16 = onoff.Install (c.Get (17));
+void
+BatchedMobility::SetPeriod (Time period)
+{
+  m_period = period;
+}
 
-  apps16.Start (Seconds (0.5));
-  apps16.Stop (Seconds (250.0));
+void
+BatchedMobility::SetLimits (double x, double y)
+{
+  m_xLimit = x;
+  m_yLimit = y;
+}
 
-ApplicationContainer apps17 = onoff.Install (c.Get (18));
+void
+BatchedMobility::Add (Ptr<Node> node, Time start, Vector velocity)
+{
+  std::map<Time, uint32_t>::iterator i = m_groupOfStart.find (start);
+  if (i == m_groupOfStart.end ())
+    {
+      i = m_groupOfStart.insert (std::make_pair (start, m_groups.size ())).first;
+      m_groups.push_back (Group ());
+      m_groups.back ().start = start;
+    }
+  Group &group = m_groups[i->second];
+  Ptr<MobilityModel> model = node->GetObject<MobilityModel> ();
+  Vector position = model->GetPosition ();
+  group.models.push_back (model);
+  group.x.push_back (position.x);
+  group.y.push_back (position.y);
+  group.z.push_back (position.z);
+  group.vx.push_back (velocity.x);
+  group.vy.push_back (velocity.y);
+  group.vz.push_back (velocity.z);
+  group.active.push_back (1);
+  group.moved.push_back (0);
+}
 
-  apps17.Start (Seconds (0.10));
-  apps17.Stop (Seconds (250.0));
+void
+BatchedMobility::Start (void)
+{
+  for (uint32_t i = 0; i < m_groups.size (); i++)
+    {
+      Simulator::Schedule (m_groups[i].start, &BatchedMobility::Step, this, i);
+    }
+}
+
+void
+BatchedMobility::Clear (void)
+{
+  m_groupOfStart.clear ();
+  m_groups.clear ();
+}
+
+void
+BatchedMobility::Step (uint32_t index)
+{
+  Group &group = m_groups[index];
+  uint32_t n = group.models.size ();
+  double *x = &group.x[0];
+  double *y = &group.y[0];
+  double *z = &group.z[0];
+  const double *vx = &group.vx[0];
+  const double *vy = &group.vy[0];
+  const double *vz = &group.vz[0];
+  uint8_t *active = &group.active[0];
+  uint8_t *moved = &group.moved[0];
+  uint32_t nActive = 0;
+  for (uint32_t i = 0; i < n; i++)
+    {
+      double nx = x[i] + vx[i];
+      double ny = y[i] + vy[i];
+      double nz = z[i] + vz[i];
+      uint8_t move = active[i] & (nx < m_xLimit) & (ny < m_yLimit);
+      x[i] = move ? nx : x[i];
+      y[i] = move ? ny : y[i];
+      z[i] = move ? nz : z[i];
+      moved[i] = move && (vx[i] != 0.0 || vy[i] != 0.0 || vz[i] != 0.0);
+      active[i] = move;
+      nActive += move;
+    }
+  for (uint32_t i = 0; i < n; i++)
+    {
+      if (moved[i])
+        {
+          group.models[i]->SetPosition (Vector (x[i], y[i], z[i]));
+        }
+    }
+  if (nActive != 0)
+    {
+      Simulator::Schedule (m_period, &BatchedMobility::Step, this, index);
+    }
+}
+
+/***************************************************************************/
+
+/** Convergence control **/
+/***************************************************************************/
+
+/**
+ * Decides when a throughput series has converged, with the method of batch
+ * means.  The samples taken after the warm-up are split into Batches equal
+ * batches; the series has converged once the half-width of the 95%
+ * confidence interval of the batch means is within RelativePrecision of
+ * their mean, or within AbsolutePrecision Mbit/s.
+ */
+class ConvergenceController
+{
+public:
+  ConvergenceController ();
+  void Configure (double relativePrecision, double absolutePrecision, uint32_t batches,
+                  uint32_t minBatchSize, Time warmup);
+  void Reset (void);
+  /// Adds a sample and returns true once the series has converged.
+  bool Add (Time now, double value);
+  double GetMean (void) const;
+  double GetHalfWidth (void) const;
+  /// Writes the configuration, not the state, as "key=value" lines.
+  void Print (std::ostream &os) const;
+private:
+  double m_relativePrecision;
+  double m_absolutePrecision;
+  uint32_t m_batches;
+  uint32_t m_minBatchSize;
+  Time m_warmup;
+  std::vector<double> m_values;
+  double m_mean;
+  double m_halfWidth;
+};
+
+ConvergenceController::ConvergenceController ()
+  : m_relativePrecision (0.05),
+    m_absolutePrecision (0.01),
+    m_batches (10),
+    m_minBatchSize (5),
+    m_warmup (Seconds (10.0)),
+    m_mean (0.0),
+    m_halfWidth (0.0)
+{
+}
+
+void
+ConvergenceController::Configure (double relativePrecision, double absolutePrecision, uint32_t batches,
+                                  uint32_t minBatchSize, Time warmup)
+{
+  NS_ABORT_MSG_IF (batches < 2, "Batch means need at least 2 batches");
+  m_relativePrecision = relativePrecision;
+  m_absolutePrecision = absolutePrecision;
+  m_batches = batches;
+  m_minBatchSize = std::max (minBatchSize, 1u);
+  m_warmup = warmup;
+}
+
+void
+ConvergenceController::Reset (void)
+{
+  m_values.clear ();
+  m_mean = 0.0;
+  m_halfWidth = 0.0;
+}
+
+bool
+ConvergenceController::Add (Time now, double value)
+{
+  if (now < m_warmup)
+    {
+      return false;
+    }
+  m_values.push_back (value);
+  uint32_t batchSize = m_values.size () / m_batches;
+  if (batchSize < m_minBatchSize)
+    {
+      return false;
+    }
+  std::vector<double> means (m_batches, 0.0);
+  for (uint32_t i = 0; i < m_batches * batchSize; i++)
+    {
+      means[i / batchSize] += m_values[i] / batchSize;
+    }
+  double sum = 0.0;
+  for (uint32_t i = 0; i < m_batches; i++)
+    {
+      sum += means[i];
+    }
+  m_mean = sum / m_batches;
+  double squares = 0.0;
+  for (uint32_t i = 0; i < m_batches; i++)
+    {
+      squares += (means[i] - m_mean) * (means[i] - m_mean);
+    }
+  // two-sided 95% Student t quantiles for 1 to 30 degrees of freedom
+  static const double t[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                              2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                              2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+  uint32_t df = m_batches - 1;
+  double quantile = df <= 30 ? t[df - 1] : 1.96;
+  m_halfWidth = quantile * std::sqrt (squares / df / m_batches);
+  return m_halfWidth <= m_absolutePrecision || m_halfWidth <= m_relativePrecision * std::fabs (m_mean);
+}
+
+double
+ConvergenceController::GetMean (void) const
+{
+  return m_mean;
+}
+
+double
+ConvergenceController::GetHalfWidth (void) const
+{
+  return m_halfWidth;
+}
+
+void
+ConvergenceController::Print (std::ostream &os) const
+{
+  os << "convergence.relativePrecision=" << m_relativePrecision << std::endl
+     << "convergence.absolutePrecision=" << m_absolutePrecision << std::endl
+     << "convergence.batches=" << m_batches << std::endl
+     << "convergence.minBatchSize=" << m_minBatchSize << std::endl
+     << "convergence.warmup=" << m_warmup.GetTimeStep () << std::endl;
+}
+
+/***************************************************************************/
+
+/** Lazy energy accounting **/
+/***************************************************************************/
+
+/**
+ * Event-driven energy accounting for BasicEnergySource.
+ *
+ * The periodic update of the sources is pushed past the end of the run, so
+ * energy is only integrated when a WifiRadioEnergyModel reports a radio
+ * state change or when the remaining energy is queried.  What the periodic
+ * update still did was to notice a drained battery while the radio sits in
+ * one state; for that one check per source is scheduled on the periodic
+ * update grid, at the first update after the earliest possible depletion
+ * (all devices drawing their largest current), and moved on when it finds
+ * the battery still charged.
+ *
+ * Any update of a source, whoever asks for it, restarts its periodic grid.
+ * The grid and the energy it starts from are therefore followed from the
+ * RemainingEnergy trace, which fires on every update that integrates a
+ * non-zero draw, and the checks never query the source themselves.  Each
+ * update moves the pending check to the new grid unless it comes earlier
+ * anyway, in which case it only reschedules itself.  With every radio
+ * current positive, which Install enforces, batteries drain at the same
+ * instants as with periodic updates every Interval and the remaining
+ * energy differs by rounding only; LazyEnergyTestCase compares the two
+ * modes.
+ */
+class LazyEnergyAccounting
+{
+public:
+  /// sources.Get (i) must feed devices.Get (i)
+  void Install (EnergySourceContainer sources, NetDeviceContainer devices, Time interval);
+private:
+  static void NotifyUpdate (LazyEnergyAccounting *accounting, uint32_t index, double oldValue, double remaining);
+  /// Sum over the radio models of their largest current and smallest of all their currents, in A.
+  void GetCurrents (uint32_t index, double &largest, double &smallest) const;
+  void ScheduleCheck (uint32_t index);
+  void Check (uint32_t index);
+
+  Time m_interval;
+  std::vector<Ptr<BasicEnergySource> > m_sources;
+  std::vector<Time> m_lastUpdate;     ///< last update of each source, the base of its periodic update grid
+  std::vector<double> m_remaining;    ///< J remaining at the last update of each source
+  std::vector<EventId> m_checks;      ///< pending check of each source
+};
+
+void
+LazyEnergyAccounting::Install (EnergySourceContainer sources, NetDeviceContainer devices, Time interval)
+{
+  m_interval = interval;
+  m_sources.clear ();
+  m_lastUpdate.assign (sources.GetN (), Seconds (0.0));
+  m_remaining.clear ();
+  m_checks.assign (sources.GetN (), EventId ());
+  for (uint32_t i = 0; i < sources.GetN (); i++)
+    {
+      m_sources.push_back (DynamicCast<BasicEnergySource> (sources.Get (i)));
+      m_remaining.push_back (m_sources[i]->GetInitialEnergy ());
+      double largest, smallest;
+      GetCurrents (i, largest, smallest);
+      // an update integrating no draw would leave the trace silent and the grid unfollowed
+      NS_ABORT_MSG_IF (smallest <= 0.0, "Lazy energy accounting needs positive radio currents");
+      m_sources[i]->TraceConnectWithoutContext ("RemainingEnergy",
+                                                MakeBoundCallback (&LazyEnergyAccounting::NotifyUpdate, this, i));
+      ScheduleCheck (i);
+    }
+}
+
+void
+LazyEnergyAccounting::NotifyUpdate (LazyEnergyAccounting *accounting, uint32_t index, double oldValue,
+                                    double remaining)
+{
+  accounting->m_lastUpdate[index] = Simulator::Now ();
+  accounting->m_remaining[index] = remaining;
+  accounting->ScheduleCheck (index);
+}
+
+void
+LazyEnergyAccounting::GetCurrents (uint32_t index, double &largest, double &smallest) const
+{
+  const char *currents[] = { "TxCurrentA", "RxCurrentA", "IdleCurrentA", "CcaBusyCurrentA",
+                             "SwitchingCurrentA", "SleepCurrentA" };
+  DeviceEnergyModelContainer models = m_sources[index]->FindDeviceEnergyModels ("ns3::WifiRadioEnergyModel");
+  largest = 0.0;
+  smallest = std::numeric_limits<double>::infinity ();
+  for (uint32_t i = 0; i < models.GetN (); i++)
+    {
+      double modelLargest = 0.0;
+      for (uint32_t j = 0; j < sizeof (currents) / sizeof (currents[0]); j++)
+        {
+          DoubleValue value;
+          models.Get (i)->GetAttribute (currents[j], value);
+          modelLargest = std::max (modelLargest, value.Get ());
+          smallest = std::min (smallest, value.Get ());
+        }
+      largest += modelLargest;
+    }
+}
+
+void
+LazyEnergyAccounting::ScheduleCheck (uint32_t index)
+{
+  Ptr<BasicEnergySource> source = m_sources[index];
+  DoubleValue threshold;
+  source->GetAttribute ("BasicEnergyLowBatteryThreshold", threshold);
+  double spare = m_remaining[index] - threshold.Get () * source->GetInitialEnergy ();
+  double largest, smallest;
+  GetCurrents (index, largest, smallest);
+  double power = largest * source->GetSupplyVoltage ();
+  if (spare <= 0.0 || power <= 0.0)
+    {
+      return;
+    }
+  // counted from the last update, whose energy is the last one known
+  Time base = m_lastUpdate[index];
+  int64_t periods = std::max<int64_t> (1, std::ceil (spare / power / m_interval.GetSeconds ()));
+  Time check = base + TimeStep (m_interval.GetTimeStep () * periods);
+  while (check <= Simulator::Now ())
+    {
+      check = check + m_interval;
+    }
+  if (m_checks[index].IsRunning ())
+    {
+      if (m_checks[index].GetTs () <= static_cast<uint64_t> (check.GetTimeStep ()))
+        {
+          return;
+        }
+      Simulator::Remove (m_checks[index]);
+    }
+  m_checks[index] = Simulator::Schedule (check - Simulator::Now (), &LazyEnergyAccounting::Check, this, index);
+}
+
+void
+LazyEnergyAccounting::Check (uint32_t index)
+{
+  Time elapsed = Simulator::Now () - m_lastUpdate[index];
+  if (elapsed.GetTimeStep () % m_interval.GetTimeStep () == 0)
+    {
+      // the periodic mode updates the source right now
+      m_sources[index]->UpdateEnergySource ();
+      m_lastUpdate[index] = Simulator::Now ();
+    }
+  ScheduleCheck (index);
+}
+
+/***************************************************************************/
+
+/** Scheduler instrumentation **/
+/***************************************************************************/
+
+static uint64_t g_schedulerDepth = 0;       ///< events in the current DepthTrackingScheduler
+static uint64_t g_schedulerPeakDepth = 0;   ///< largest g_schedulerDepth of the current simulation
+static uint32_t g_schedulerContext = 0xffffffff; ///< context of the event handed out last, the running one
+
+/**
+ * Scheduler counting the events queued in the Inner scheduler it forwards to,
+ * and keeping the context of the event it hands out to the simulator, which
+ * runs it next.  Select it with the SchedulerType global value, or
+ * EnableSchedulerTracking; the depth is kept in process-wide counters so it
+ * survives Simulator::Destroy.
+ */
+class DepthTrackingScheduler : public Scheduler
+{
+public:
+  static TypeId GetTypeId (void);
+  DepthTrackingScheduler ();
+  /// Number of events queued right now.
+  static uint64_t GetDepth (void);
+  /// Largest number of events queued since the scheduler was created.
+  static uint64_t GetPeakDepth (void);
+  /// Context of the running event, read without calling into the simulator.
+  static uint32_t GetRunningContext (void);
+
+  virtual void Insert (const Event &ev);
+  virtual bool IsEmpty (void) const;
+  virtual Event PeekNext (void) const;
+  virtual Event RemoveNext (void);
+  virtual void Remove (const Event &ev);
+private:
+  Ptr<Scheduler> GetInner (void) const;
+
+  TypeId m_innerType;
+  mutable Ptr<Scheduler> m_inner;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (DepthTrackingScheduler);
+
+TypeId
+DepthTrackingScheduler::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::DepthTrackingScheduler")
+    .SetParent<Scheduler> ()
+    .AddConstructor<DepthTrackingScheduler> ()
+    .AddAttribute ("Inner", "The scheduler holding the events.",
+                   TypeIdValue (MapScheduler::GetTypeId ()),
+                   MakeTypeIdAccessor (&DepthTrackingScheduler::m_innerType),
+                   MakeTypeIdChecker ())
+  ;
+  return tid;
+}
+
+DepthTrackingScheduler::DepthTrackingScheduler ()
+{
+  g_schedulerDepth = 0;
+  g_schedulerPeakDepth = 0;
+}
+
+uint64_t
+DepthTrackingScheduler::GetDepth (void)
+{
+  return g_schedulerDepth;
+}
+
+uint64_t
+DepthTrackingScheduler::GetPeakDepth (void)
+{
+  return g_schedulerPeakDepth;
+}
+
+uint32_t
+DepthTrackingScheduler::GetRunningContext (void)
+{
+  return g_schedulerContext;
+}
+
+Ptr<Scheduler>
+DepthTrackingScheduler::GetInner (void) const
+{
+  if (m_inner == 0)
+    {
+      ObjectFactory factory;
+      factory.SetTypeId (m_innerType);
+      m_inner = factory.Create<Scheduler> ();
+    }
+  return m_inner;
+}
+
+void
+DepthTrackingScheduler::Insert (const Event &ev)
+{
+  GetInner ()->Insert (ev);
+  g_schedulerDepth++;
+  g_schedulerPeakDepth = std::max (g_schedulerPeakDepth, g_schedulerDepth);
+}
+
+bool
+DepthTrackingScheduler::IsEmpty (void) const
+{
+  return GetInner ()->IsEmpty ();
+}
+
+Scheduler::Event
+DepthTrackingScheduler::PeekNext (void) const
+{
+  return GetInner ()->PeekNext ();
+}
+
+Scheduler::Event
+DepthTrackingScheduler::RemoveNext (void)
+{
+  g_schedulerDepth--;
+  Event ev = GetInner ()->RemoveNext ();
+  g_schedulerContext = ev.key.m_context;
+  return ev;
+}
+
+void
+DepthTrackingScheduler::Remove (const Event &ev)
+{
+  g_schedulerDepth--;
+  GetInner ()->Remove (ev);
+}
+
+/// Makes DepthTrackingScheduler the SchedulerType, forwarding to the scheduler selected so far.
+static void
+EnableSchedulerTracking (void)
+{
+  TypeIdValue schedulerType;
+  GlobalValue::GetValueByName ("SchedulerType", schedulerType);
+  if (schedulerType.Get () != DepthTrackingScheduler::GetTypeId ())
+    {
+      Config::SetDefault ("ns3::DepthTrackingScheduler::Inner", StringValue (schedulerType.Get ().GetName ()));
+      GlobalValue::Bind ("SchedulerType", TypeIdValue (DepthTrackingScheduler::GetTypeId ()));
+    }
+}
+
+/***************************************************************************/
+
+/** Timing wheel scheduler **/
+/***************************************************************************/
+
+/**
+ * Hierarchical timing wheel.  Timestamps are cut into slots of 2^SlotShift
+ * time steps; four levels of 256 slots cover the 2^32 slots following the
+ * current one and later events wait in an ordered overflow set.  Inserting
+ * into a future slot appends to a vector, an event moves down one level
+ * when its slot at the upper level comes up, and the events of the current
+ * slot sit in a small binary heap ordered by timestamp then uid, so the
+ * event order is exactly that of the Map, Heap and Calendar schedulers.
+ * Remove only records the uid of the event, which is dropped when its
+ * slot comes up or it reaches the front of the heap, so every operation
+ * but the move of an overflow event takes constant amortized time.
+ */
+class TimingWheelScheduler : public Scheduler
+{
+public:
+  static TypeId GetTypeId (void);
+  TimingWheelScheduler ();
+
+  virtual void Insert (const Event &ev);
+  virtual bool IsEmpty (void) const;
+  virtual Event PeekNext (void) const;
+  virtual Event RemoveNext (void);
+  virtual void Remove (const Event &ev);
+private:
+  enum
+  {
+    LEVELS = 4,
+    LEVEL_BITS = 8,
+    SLOTS = 1 << LEVEL_BITS
+  };
+
+  /// Heap order putting the earliest event at the front.
+  static bool Later (const Event &a, const Event &b);
+  /// Wheel holding the slot given its distance to the current slot, LEVELS for the overflow set.
+  uint32_t GetLevel (uint64_t slot) const;
+  /// First occupied slot of the level at or after index, -1 if none.
+  int32_t FindOccupied (uint32_t level, uint32_t index) const;
+  /// Forgets the removal of an event; true if it was removed.
+  bool TakeRemoved (const Event &ev) const;
+  void Place (const Event &ev) const;
+  /// Moves the current slot forward until it holds events.
+  void Advance (void) const;
+
+  uint32_t m_slotShift;
+  uint64_t m_count;
+  mutable uint64_t m_current;                     ///< slot of the events in m_ready
+  mutable std::vector<Event> m_ready;             ///< heap of the events of the current slot
+  mutable std::vector<Event> m_slots[LEVELS][SLOTS];
+  mutable uint64_t m_occupied[LEVELS][SLOTS / 64]; ///< bitmaps of the non-empty slots
+  mutable std::set<Event> m_overflow;
+  mutable std::unordered_set<uint32_t> m_removed; ///< uids of removed events still held above
+};
+
+NS_OBJECT_ENSURE_REGISTERED (TimingWheelScheduler);
+
+TypeId
+TimingWheelScheduler::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::TimingWheelScheduler")
+    .SetParent<Scheduler> ()
+    .AddConstructor<TimingWheelScheduler> ()
+    .AddAttribute ("SlotShift", "Log2 of the number of time steps per slot.",
+                   UintegerValue (10),
+                   MakeUintegerAccessor (&TimingWheelScheduler::m_slotShift),
+                   MakeUintegerChecker<uint32_t> (0, 31))
+  ;
+  return tid;
+}
+
+TimingWheelScheduler::TimingWheelScheduler ()
+  : m_slotShift (10),
+    m_count (0),
+    m_current (0)
+{
+  std::memset (m_occupied, 0, sizeof (m_occupied));
+}
+
+bool
+TimingWheelScheduler::Later (const Event &a, const Event &b)
+{
+  return b.key < a.key;
+}
+
+uint32_t
+TimingWheelScheduler::GetLevel (uint64_t slot) const
+{
+  uint64_t diff = slot ^ m_current;
+  uint32_t level = 0;
+  while (level < LEVELS && (diff >> (LEVEL_BITS * (level + 1))) != 0)
+    {
+      level++;
+    }
+  return level;
+}
+
+int32_t
+TimingWheelScheduler::FindOccupied (uint32_t level, uint32_t index) const
+{
+  for (uint32_t word = index / 64; word < SLOTS / 64; word++)
+    {
+      uint64_t bits = m_occupied[level][word];
+      if (word == index / 64)
+        {
+          bits &= ~0ULL << (index % 64);
+        }
+      if (bits != 0)
+        {
+          return word * 64 + __builtin_ctzll (bits);
+        }
+    }
+  return -1;
+}
+
+bool
+TimingWheelScheduler::TakeRemoved (const Event &ev) const
+{
+  return !m_removed.empty () && m_removed.erase (ev.key.m_uid) != 0;
+}
+
+void
+TimingWheelScheduler::Place (const Event &ev) const
+{
+  if (TakeRemoved (ev))
+    {
+      return;
+    }
+  uint64_t slot = ev.key.m_ts >> m_slotShift;
+  if (slot <= m_current)
+    {
+      // events before the current slot only arrive after a PeekNext and
+      // still come out first
+      m_ready.push_back (ev);
+      std::push_heap (m_ready.begin (), m_ready.end (), &TimingWheelScheduler::Later);
+      return;
+    }
+  uint32_t level = GetLevel (slot);
+  if (level == LEVELS)
+    {
+      m_overflow.insert (ev);
+      return;
+    }
+  uint32_t index = (slot >> (LEVEL_BITS * level)) & (SLOTS - 1);
+  m_slots[level][index].push_back (ev);
+  m_occupied[level][index / 64] |= 1ULL << (index % 64);
+}
+
+void
+TimingWheelScheduler::Advance (void) const
+{
+  for (;;)
+    {
+      while (!m_ready.empty () && TakeRemoved (m_ready.front ()))
+        {
+          std::pop_heap (m_ready.begin (), m_ready.end (), &TimingWheelScheduler::Later);
+          m_ready.pop_back ();
+        }
+      if (!m_ready.empty ())
+        {
+          return;
+        }
+      uint32_t level = 0;
+      int32_t index = -1;
+      for (; level < LEVELS; level++)
+        {
+          index = FindOccupied (level, ((m_current >> (LEVEL_BITS * level)) & (SLOTS - 1)) + 1);
+          if (index >= 0)
+            {
+              break;
+            }
+        }
+      if (level == LEVELS)
+        {
+          // every wheel is empty: restart them at the earliest overflow event
+          NS_ASSERT (!m_overflow.empty ());
+          m_current = m_overflow.begin ()->key.m_ts >> m_slotShift;
+          std::set<Event>::iterator i = m_overflow.begin ();
+          while (i != m_overflow.end () && GetLevel (i->key.m_ts >> m_slotShift) < LEVELS)
+            {
+              Place (*i);
+              m_overflow.erase (i++);
+            }
+          continue;
+        }
+      uint32_t shift = LEVEL_BITS * level;
+      m_current = (m_current >> (shift + LEVEL_BITS) << (shift + LEVEL_BITS)) | (uint64_t (index) << shift);
+      std::vector<Event> &slot = m_slots[level][index];
+      m_occupied[level][index / 64] &= ~(1ULL << (index % 64));
+      // the events of the slot all land on lower levels or in m_ready
+      for (std::vector<Event>::const_iterator i = slot.begin (); i != slot.end (); ++i)
+        {
+          Place (*i);
+        }
+      slot.clear ();
+    }
+}
+
+void
+TimingWheelScheduler::Insert (const Event &ev)
+{
+  Place (ev);
+  m_count++;
+}
+
+bool
+TimingWheelScheduler::IsEmpty (void) const
+{
+  return m_count == 0;
+}
+
+Scheduler::Event
+TimingWheelScheduler::PeekNext (void) const
+{
+  Advance ();
+  return m_ready.front ();
+}
+
+Scheduler::Event
+TimingWheelScheduler::RemoveNext (void)
+{
+  Advance ();
+  std::pop_heap (m_ready.begin (), m_ready.end (), &TimingWheelScheduler::Later);
+  Event ev = m_ready.back ();
+  m_ready.pop_back ();
+  m_count--;
+  return ev;
+}
+
+void
+TimingWheelScheduler::Remove (const Event &ev)
+{
+  // the event stays in its slot, heap or the overflow set until Advance meets it
+  m_removed.insert (ev.key.m_uid);
+  m_count--;
+}
+
+/***************************************************************************/
+
+/** Event profiling **/
+/***************************************************************************/
+
+/// Cycle counter used to time events: the TSC where there is one.
+static inline uint64_t
+ReadCycles (void)
+{
+#if defined (__x86_64__) || defined (__i386__)
+  return __rdtsc ();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds> (
+    std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+#endif
+}
+
+/**
+ * Simulator implementation attributing wall time to the functions events
+ * call.
+ *
+ * Every scheduled event is wrapped in a ProfiledEvent that reads the cycle
+ * counter around its invocation.  The class of an event built by MakeEvent
+ * only tells the signature of the function it calls, which it keeps as
+ * data after the bound object.  On x86 the function is read from there, as
+ * laid out by the Itanium C++ ABI, a virtual one looked up in the vtable
+ * of the object, and events are grouped by function and named after its
+ * symbol, or module and offset for addr2line when it has none.  Events of
+ * other classes, and all of them elsewhere, are grouped by class.
+ * Simulator::Destroy prints the groups sorted by total time to stderr and,
+ * when FlameGraphFile is set, writes them in the folded stack format of
+ * flamegraph.pl.  Select it with the SimulatorImplementationType global
+ * value; the default implementation stays untouched otherwise.
+ */
+class ProfilingSimulatorImpl : public DefaultSimulatorImpl
+{
+public:
+  static TypeId GetTypeId (void);
+  ProfilingSimulatorImpl ();
+
+  virtual EventId Schedule (Time const &delay, EventImpl *event);
+  virtual void ScheduleWithContext (uint32_t context, Time const &delay, EventImpl *event);
+  virtual EventId ScheduleNow (EventImpl *event);
+  virtual void Destroy ();
+private:
+  /// Times the event it wraps and owns.
+  class ProfiledEvent : public EventImpl
+  {
+  public:
+    ProfiledEvent (ProfilingSimulatorImpl *profiler, uint32_t site, EventImpl *event);
+    virtual ~ProfiledEvent ();
+  protected:
+    virtual void Notify (void);
+  private:
+    ProfilingSimulatorImpl *m_profiler;
+    uint32_t m_site;
+    EventImpl *m_event;
+  };
+
+  /// What the class of an event tells about the function it calls.
+  enum EventKind
+  {
+    EVENT_OTHER,              ///< not built by MakeEvent, or not on x86
+    EVENT_MEMBER,             ///< MakeEvent of a member function and its object
+    EVENT_FUNCTION            ///< MakeEvent of a free function
+  };
+  /// Itanium C++ ABI pointer to member function: a function address, or 1 + vtable offset if virtual.
+  struct MemberFunctionPointer
+  {
+    uintptr_t pointer;
+    ptrdiff_t adjustment;     ///< of the object pointer
+  };
+  /// Data of the events MakeEvent builds for a member function: the object, a pointer or a Ptr, then the function.
+  class MemberEvent : public EventImpl
+  {
+  public:
+    void *object;
+    MemberFunctionPointer function;
+  };
+  /// Data of the events MakeEvent builds for a free function.
+  class FunctionEvent : public EventImpl
+  {
+  public:
+    void (*function) (void);
+  };
+  /// Wall time spent in the events calling one function.
+  struct Site
+  {
+    std::string name;
+    uint64_t calls;
+    uint64_t cycles;
+  };
+  /// The sites of the events of one class.
+  struct EventClass
+  {
+    EventKind kind;
+    std::string name;         ///< demangled
+    std::map<const void *, uint32_t> sites; ///< by function, a single one at 0 for EVENT_OTHER
+  };
+
+  EventImpl *Wrap (EventImpl *event);
+  static const void *GetFunction (EventImpl *event, EventKind kind);
+  static std::string GetFunctionName (const void *function, std::string eventClass);
+  void Report (void);
+
+  std::string m_flameGraphFile;
+  std::map<std::type_index, EventClass> m_classes;
+  std::vector<Site> m_sites;
+  uint64_t m_startCycles;
+  std::chrono::steady_clock::time_point m_startTime;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (ProfilingSimulatorImpl);
+
+TypeId
+ProfilingSimulatorImpl::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::ProfilingSimulatorImpl")
+    .SetParent<DefaultSimulatorImpl> ()
+    .AddConstructor<ProfilingSimulatorImpl> ()
+    .AddAttribute ("FlameGraphFile", "File receiving the profile in folded stack format, if not empty.",
+                   StringValue (""),
+                   MakeStringAccessor (&ProfilingSimulatorImpl::m_flameGraphFile),
+                   MakeStringChecker ())
+  ;
+  return tid;
+}
+
+ProfilingSimulatorImpl::ProfilingSimulatorImpl ()
+  : m_startCycles (ReadCycles ()),
+    m_startTime (std::chrono::steady_clock::now ())
+{
+}
+
+ProfilingSimulatorImpl::ProfiledEvent::ProfiledEvent (ProfilingSimulatorImpl *profiler, uint32_t site,
+                                                      EventImpl *event)
+  : m_profiler (profiler),
+    m_site (site),
+    m_event (event)
+{
+}
+
+ProfilingSimulatorImpl::ProfiledEvent::~ProfiledEvent ()
+{
+  m_event->Unref ();
+}
+
+void
+ProfilingSimulatorImpl::ProfiledEvent::Notify (void)
+{
+  uint64_t start = ReadCycles ();
+  m_event->Invoke ();
+  Site &site = m_profiler->m_sites[m_site];
+  site.cycles += ReadCycles () - start;
+  site.calls++;
+}
+
+/// The function the event calls, 0 if its kind does not tell.
+const void *
+ProfilingSimulatorImpl::GetFunction (EventImpl *event, EventKind kind)
+{
+  if (kind == EVENT_MEMBER)
+    {
+      const MemberEvent *member = static_cast<const MemberEvent *> (event);
+      uintptr_t pointer = member->function.pointer;
+      if ((pointer & 1) == 0)
+        {
+          return reinterpret_cast<const void *> (pointer);
+        }
+      const char *object = static_cast<const char *> (member->object) + member->function.adjustment;
+      const char *vtable = *reinterpret_cast<const char *const *> (object);
+      return *reinterpret_cast<const void *const *> (vtable + pointer - 1);
+    }
+  if (kind == EVENT_FUNCTION)
+    {
+      return reinterpret_cast<const void *> (static_cast<const FunctionEvent *> (event)->function);
+    }
+  return 0;
+}
+
+/// The demangled symbol of a function, else its module and offset followed by the event class.
+std::string
+ProfilingSimulatorImpl::GetFunctionName (const void *function, std::string eventClass)
+{
+  void *address = const_cast<void *> (function);
+  char **symbols = backtrace_symbols (&address, 1);
+  // "<module>(<symbol>+<offset>) [<address>]", the symbol empty when unknown
+  std::string text = symbols != 0 ? symbols[0] : "";
+  std::free (symbols);
+  size_t open = text.find ('(');
+  size_t plus = text.find ('+', open);
+  if (open == std::string::npos || plus == std::string::npos || plus == open + 1)
+    {
+      return text.substr (0, text.find (" [")) + " " + eventClass;
+    }
+  std::string symbol = text.substr (open + 1, plus - open - 1);
+  int status;
+  char *demangled = abi::__cxa_demangle (symbol.c_str (), 0, 0, &status);
+  std::string name = status == 0 ? demangled : symbol;
+  std::free (demangled);
+  return name;
+}
+
+EventImpl *
+ProfilingSimulatorImpl::Wrap (EventImpl *event)
+{
+  std::type_index type (typeid (*event));
+  std::map<std::type_index, EventClass>::iterator c = m_classes.find (type);
+  if (c == m_classes.end ())
+    {
+      EventClass eventClass;
+      int status;
+      char *demangled = abi::__cxa_demangle (type.name (), 0, 0, &status);
+      eventClass.name = status == 0 ? demangled : type.name ();
+      std::free (demangled);
+      eventClass.kind = EVENT_OTHER;
+#if defined (__x86_64__) || defined (__i386__)
+      // the local classes of the MakeEvent templates of make-event.h
+      if (std::strstr (type.name (), "EventMemberImpl") != 0)
+        {
+          eventClass.kind = EVENT_MEMBER;
+        }
+      else if (std::strstr (type.name (), "EventFunctionImpl") != 0)
+        {
+          eventClass.kind = EVENT_FUNCTION;
+        }
+#endif
+      c = m_classes.insert (std::make_pair (type, eventClass)).first;
+    }
+  const void *function = GetFunction (event, c->second.kind);
+  std::map<const void *, uint32_t>::iterator i = c->second.sites.find (function);
+  if (i == c->second.sites.end ())
+    {
+      Site site;
+      site.name = c->second.kind == EVENT_OTHER ? c->second.name : GetFunctionName (function, c->second.name);
+      site.calls = 0;
+      site.cycles = 0;
+      i = c->second.sites.insert (std::make_pair (function, m_sites.size ())).first;
+      m_sites.push_back (site);
+    }
+  return new ProfiledEvent (this, i->second, event);
+}
+
+EventId
+ProfilingSimulatorImpl::Schedule (Time const &delay, EventImpl *event)
+{
+  return DefaultSimulatorImpl::Schedule (delay, Wrap (event));
+}
+
+void
+ProfilingSimulatorImpl::ScheduleWithContext (uint32_t context, Time const &delay, EventImpl *event)
+{
+  DefaultSimulatorImpl::ScheduleWithContext (context, delay, Wrap (event));
+}
+
+EventId
+ProfilingSimulatorImpl::ScheduleNow (EventImpl *event)
+{
+  return DefaultSimulatorImpl::ScheduleNow (Wrap (event));
+}
+
+void
+ProfilingSimulatorImpl::Destroy ()
+{
+  Report ();
+  DefaultSimulatorImpl::Destroy ();
+}
+
+void
+ProfilingSimulatorImpl::Report (void)
+{
+  double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - m_startTime).count ();
+  double cyclesPerSecond = seconds > 0 ? (ReadCycles () - m_startCycles) / seconds : 1.0;
+  std::vector<Site> sites = m_sites;
+  std::sort (sites.begin (), sites.end (),
+             [] (const Site &a, const Site &b) { return a.cycles > b.cycles; });
+  uint64_t total = 0;
+  for (std::vector<Site>::const_iterator i = sites.begin (); i != sites.end (); ++i)
+    {
+      total += i->cycles;
+    }
+  std::cerr << "      calls    total ms   mean us      %  function" << std::endl;
+  for (std::vector<Site>::const_iterator i = sites.begin (); i != sites.end (); ++i)
+    {
+      if (i->calls == 0)
+        {
+          continue;
+        }
+      double ms = i->cycles / cyclesPerSecond * 1e3;
+      std::cerr << std::setw (11) << i->calls
+                << std::setw (12) << std::fixed << std::setprecision (1) << ms
+                << std::setw (10) << std::setprecision (2) << ms * 1e3 / i->calls
+                << std::setw (7) << std::setprecision (1) << (total ? 100.0 * i->cycles / total : 0.0)
+                << "  " << i->name << std::endl;
+    }
+  std::cerr.unsetf (std::ios::floatfield);
+  if (!m_flameGraphFile.empty ())
+    {
+      std::ofstream out (m_flameGraphFile.c_str ());
+      NS_ABORT_MSG_IF (!out, "Cannot create " << m_flameGraphFile);
+      for (std::vector<Site>::const_iterator i = sites.begin (); i != sites.end (); ++i)
+        {
+          std::string frame = i->name;
+          std::replace (frame.begin (), frame.end (), ';', ':');
+          std::replace (frame.begin (), frame.end (), ' ', '_');
+          out << "Simulator::Run;" << frame << " "
+              << static_cast<uint64_t> (i->cycles / cyclesPerSecond * 1e6) << std::endl;
+        }
+    }
+  m_sites.clear ();
+  m_classes.clear ();
+}
+
+/***************************************************************************/
+
+/** Series files **/
+/***************************************************************************/
+
+/**
+ * Appends the points of a dataset to a text file while they are produced,
+ * so that memory stays constant however long the run and a crashed run
+ * leaves the points written so far.  With a bucket size above 1 only the
+ * lowest and the highest point of every bucket of consecutive points are
+ * written, in x order, which keeps the peaks of the series visible.
+ */
+class SeriesWriter
+{
+public:
+  SeriesWriter ();
+  void Open (std::string path, uint32_t bucketSize);
+  bool IsOpen (void) const;
+  void Add (double x, double y);
+  /// Writes the last partial bucket and closes the file.
+  void Close (void);
+  /// Number of points written to the file.
+  uint64_t GetWritten (void) const;
+private:
+  void WriteBucket (void);
+
+  std::ofstream m_out;
+  uint32_t m_bucketSize;
+  uint32_t m_count;           ///< points in the current bucket
+  double m_minX;
+  double m_minY;
+  double m_maxX;
+  double m_maxY;
+  uint64_t m_written;
+};
+
+SeriesWriter::SeriesWriter ()
+  : m_bucketSize (1),
+    m_count (0),
+    m_written (0)
+{
+}
+
+void
+SeriesWriter::Open (std::string path, uint32_t bucketSize)
+{
+  m_out.open (path.c_str ());
+  NS_ABORT_MSG_IF (!m_out, "Cannot create " << path);
+  m_out.precision (17);
+  m_bucketSize = std::max (bucketSize, 1u);
+  m_count = 0;
+  m_written = 0;
+}
+
+bool
+SeriesWriter::IsOpen (void) const
+{
+  return m_out.is_open ();
+}
+
+void
+SeriesWriter::Add (double x, double y)
+{
+  if (m_count == 0 || y < m_minY)
+    {
+      m_minX = x;
+      m_minY = y;
+    }
+  if (m_count == 0 || y > m_maxY)
+    {
+      m_maxX = x;
+      m_maxY = y;
+    }
+  if (++m_count == m_bucketSize)
+    {
+      WriteBucket ();
+    }
+}
+
+void
+SeriesWriter::WriteBucket (void)
+{
+  if (m_minX == m_maxX)
+    {
+      m_out << m_minX << " " << m_minY << "\n";
+      m_written++;
+    }
+  else
+    {
+      bool minFirst = m_minX < m_maxX;
+      m_out << (minFirst ? m_minX : m_maxX) << " " << (minFirst ? m_minY : m_maxY) << "\n"
+            << (minFirst ? m_maxX : m_minX) << " " << (minFirst ? m_maxY : m_minY) << "\n";
+      m_written += 2;
+    }
+  m_out.flush ();
+  m_count = 0;
+}
+
+void
+SeriesWriter::Close (void)
+{
+  if (m_count != 0)
+    {
+      WriteBucket ();
+    }
+  m_out.close ();
+}
+
+uint64_t
+SeriesWriter::GetWritten (void) const
+{
+  return m_written;
+}
+
+/***************************************************************************/
+
+/** Memory accounting **/
+/***************************************************************************/
+
+/**
+ * What an allocation was made for.  Components are the installation steps
+ * of Experiment::Run: the helpers create their objects inside ns-3 through
+ * ObjectFactory::Create and CreateObject, which offer no hook to scope the
+ * allocations of a constructor by the TypeId being built without patching
+ * ns-3.  Each step mostly builds one model family, such as the wifi device,
+ * PHY, MAC and station manager for MEMORY_WIFI.  WriteMemoryReport adds the
+ * blocks of the objects themselves by TypeId.
+ *
+ * Allocations are only tagged in builds with SAMPLE2_MEMORY_ACCOUNTING
+ * defined, which replace the global operator new and delete; other builds
+ * leave the allocator alone and refuse EnableMemoryAccounting.
+ */
+enum MemoryComponent
+{
+  MEMORY_OTHER,
+  MEMORY_NODES,
+  MEMORY_PACKET_SOCKET,
+  MEMORY_WIFI,
+  MEMORY_INTERNET,
+  MEMORY_MOBILITY,
+  MEMORY_ENERGY,
+  MEMORY_APPLICATIONS,
+  MEMORY_SINKS,
+  MEMORY_SIMULATION,          ///< allocated by the events of a node while the simulation runs
+  MEMORY_COMPONENTS
+};
+
+static const char *g_memoryComponentNames[MEMORY_COMPONENTS] = {
+  "other", "nodes", "packet-socket", "wifi", "internet", "mobility", "energy", "applications", "sinks",
+  "simulation"
+};
+
+static const uint32_t MEMORY_NO_NODE = 0xffffffff;
+static const uint32_t MEMORY_CONTEXT_NODE = 0xfffffffe;   ///< the node of the running event, needs EnableSchedulerTracking
+static const uint32_t MEMORY_MAX_NODES = 1 << 20;
+
+/// Owner of a live allocation.
+struct MemoryTag
+{
+  uint64_t size;
+  uint32_t node;
+  uint8_t component;
+  bool array;
+};
+
+static bool g_memoryAccounting = false;
+static uint32_t g_memoryFirstNode = 0;
+static thread_local uint8_t t_memoryComponent = MEMORY_OTHER;
+static thread_local uint32_t t_memoryNode = MEMORY_NO_NODE;
+static thread_local bool t_memoryBusy = false;       ///< set while the bookkeeping itself allocates
+static std::mutex g_memoryMutex;
+// never destroyed, allocations are freed until the process ends
+static std::unordered_map<void *, MemoryTag> *g_memoryTags = 0;
+static std::vector<int64_t> *g_memoryBytes = 0;     ///< [(node + 1) * MEMORY_COMPONENTS + component], node -1 for none
+static int64_t g_memoryArrayBytes = 0;
+static int64_t g_memoryArrayPeak = 0;
+static int64_t g_memoryArrayBlocks = 0;
+static int64_t g_memoryArrayPeakBlocks = 0;
+
+/**
+ * Starts tagging every allocation with the component and node of the
+ * innermost MemoryScope.  Tags live in a side table, so allocations made
+ * before do not change; accounting stays on until the process ends.
+ */
+static void
+EnableMemoryAccounting (void)
+{
+#ifndef SAMPLE2_MEMORY_ACCOUNTING
+  NS_FATAL_ERROR ("Memory accounting needs a build with -DSAMPLE2_MEMORY_ACCOUNTING");
+#endif
+  std::lock_guard<std::mutex> lock (g_memoryMutex);
+  t_memoryBusy = true;
+  g_memoryTags = new std::unordered_map<void *, MemoryTag> ();
+  g_memoryBytes = new std::vector<int64_t> ();
+  t_memoryBusy = false;
+  g_memoryAccounting = true;
+}
+
+/// Clears the counters of the previous run; node ids from firstNode on are the nodes of the new one.
+static void
+ResetMemoryAccounting (uint32_t firstNode)
+{
+  std::lock_guard<std::mutex> lock (g_memoryMutex);
+  g_memoryFirstNode = firstNode;
+  g_memoryBytes->assign (g_memoryBytes->size (), 0);
+  g_memoryArrayPeak = g_memoryArrayBytes;
+  g_memoryArrayPeakBlocks = g_memoryArrayBlocks;
+}
+
+/// Attributes the allocations of this thread to a component and node while in scope.
+class MemoryScope
+{
+public:
+  MemoryScope (MemoryComponent component, uint32_t node);
+  ~MemoryScope ();
+private:
+  uint8_t m_component;
+  uint32_t m_node;
+};
+
+MemoryScope::MemoryScope (MemoryComponent component, uint32_t node)
+  : m_component (t_memoryComponent),
+    m_node (t_memoryNode)
+{
+  t_memoryComponent = component;
+  t_memoryNode = node;
+}
+
+MemoryScope::~MemoryScope ()
+{
+  t_memoryComponent = m_component;
+  t_memoryNode = m_node;
+}
+
+static void
+AccountMemory (const MemoryTag &tag, int64_t sign)
+{
+  size_t cell = (tag.node == MEMORY_NO_NODE ? 0 : tag.node + 1) * MEMORY_COMPONENTS + tag.component;
+  if (cell >= g_memoryBytes->size ())
+    {
+      g_memoryBytes->resize ((cell / MEMORY_COMPONENTS + 1) * MEMORY_COMPONENTS, 0);
+    }
+  (*g_memoryBytes)[cell] += sign * static_cast<int64_t> (tag.size);
+  if (tag.array)
+    {
+      g_memoryArrayBytes += sign * static_cast<int64_t> (tag.size);
+      g_memoryArrayBlocks += sign;
+      g_memoryArrayPeak = std::max (g_memoryArrayPeak, g_memoryArrayBytes);
+      g_memoryArrayPeakBlocks = std::max (g_memoryArrayPeakBlocks, g_memoryArrayBlocks);
+    }
+}
+
+#ifdef SAMPLE2_MEMORY_ACCOUNTING
+/// Allocates and tags a block aligned to alignment, 0 for malloc's; returns 0 on failure.
+static void *
+AllocateMemory (std::size_t size, std::size_t alignment, bool array)
+{
+  void *p = 0;
+  if (alignment == 0)
+    {
+      p = std::malloc (size == 0 ? 1 : size);
+    }
+  else if (posix_memalign (&p, alignment, size == 0 ? 1 : size) != 0)
+    {
+      p = 0;
+    }
+  if (p != 0 && g_memoryAccounting && !t_memoryBusy)
+    {
+      t_memoryBusy = true;
+      MemoryTag tag;
+      tag.size = size;
+      tag.node = t_memoryNode;
+      tag.component = t_memoryComponent;
+      tag.array = array;
+      if (tag.node == MEMORY_CONTEXT_NODE)
+        {
+          uint32_t context = DepthTrackingScheduler::GetRunningContext ();
+          tag.node = context >= g_memoryFirstNode && context - g_memoryFirstNode < MEMORY_MAX_NODES
+            ? context - g_memoryFirstNode : MEMORY_NO_NODE;
+        }
+      {
+        std::lock_guard<std::mutex> lock (g_memoryMutex);
+        (*g_memoryTags)[p] = tag;
+        AccountMemory (tag, 1);
+      }
+      t_memoryBusy = false;
+    }
+  return p;
+}
+
+static void *
+AllocateMemoryOrThrow (std::size_t size, std::size_t alignment, bool array)
+{
+  void *p = AllocateMemory (size, alignment, array);
+  if (p == 0)
+    {
+      throw std::bad_alloc ();
+    }
+  return p;
+}
+
+/// Untags and frees a block of AllocateMemory, aligned or not.
+static void
+FreeMemory (void *p)
+{
+  if (p != 0 && g_memoryAccounting && !t_memoryBusy)
+    {
+      t_memoryBusy = true;
+      {
+        std::lock_guard<std::mutex> lock (g_memoryMutex);
+        std::unordered_map<void *, MemoryTag>::iterator i = g_memoryTags->find (p);
+        if (i != g_memoryTags->end ())
+          {
+            AccountMemory (i->second, -1);
+            g_memoryTags->erase (i);
+          }
+      }
+      t_memoryBusy = false;
+    }
+  std::free (p);
+}
+
+// every replaceable form, so that no block crosses from one allocator to another
+
+void *
+operator new (std::size_t size)
+{
+  return AllocateMemoryOrThrow (size, 0, false);
+}
+
+void *
+operator new[] (std::size_t size)
+{
+  return AllocateMemoryOrThrow (size, 0, true);
+}
+
+void *
+operator new (std::size_t size, const std::nothrow_t &) noexcept
+{
+  return AllocateMemory (size, 0, false);
+}
+
+void *
+operator new[] (std::size_t size, const std::nothrow_t &) noexcept
+{
+  return AllocateMemory (size, 0, true);
+}
+
+void
+operator delete (void *p) noexcept
+{
+  FreeMemory (p);
+}
+
+void
+operator delete[] (void *p) noexcept
+{
+  FreeMemory (p);
+}
+
+void
+operator delete (void *p, const std::nothrow_t &) noexcept
+{
+  FreeMemory (p);
+}
+
+void
+operator delete[] (void *p, const std::nothrow_t &) noexcept
+{
+  FreeMemory (p);
+}
+
+#ifdef __cpp_sized_deallocation
+void
+operator delete (void *p, std::size_t) noexcept
+{
+  FreeMemory (p);
+}
+
+void
+operator delete[] (void *p, std::size_t) noexcept
+{
+  FreeMemory (p);
+}
+#endif
+
+#ifdef __cpp_aligned_new
+void *
+operator new (std::size_t size, std::align_val_t alignment)
+{
+  return AllocateMemoryOrThrow (size, static_cast<std::size_t> (alignment), false);
+}
+
+void *
+operator new[] (std::size_t size, std::align_val_t alignment)
+{
+  return AllocateMemoryOrThrow (size, static_cast<std::size_t> (alignment), true);
+}
+
+void *
+operator new (std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+  return AllocateMemory (size, static_cast<std::size_t> (alignment), false);
+}
+
+void *
+operator new[] (std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+  return AllocateMemory (size, static_cast<std::size_t> (alignment), true);
+}
+
+void
+operator delete (void *p, std::align_val_t) noexcept
+{
+  FreeMemory (p);
+}
+
+void
+operator delete[] (void *p, std::align_val_t) noexcept
+{
+  FreeMemory (p);
+}
+
+void
+operator delete (void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+  FreeMemory (p);
+}
+
+void
+operator delete[] (void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+  FreeMemory (p);
+}
+
+void
+operator delete (void *p, std::size_t, std::align_val_t) noexcept
+{
+  FreeMemory (p);
+}
+
+void
+operator delete[] (void *p, std::size_t, std::align_val_t) noexcept
+{
+  FreeMemory (p);
+}
+#endif
+#endif /* SAMPLE2_MEMORY_ACCOUNTING */
+
+/// Adds an object and everything aggregated to it to objects, once each.
+static void
+CollectMemoryObject (Ptr<const Object> object, std::set<const void *> &seen,
+                     std::vector<Ptr<const Object> > &objects)
+{
+  if (object == 0 || !seen.insert (dynamic_cast<const void *> (PeekPointer (object))).second)
+    {
+      return;
+    }
+  objects.push_back (object);
+  Object::AggregateIterator i = object->GetAggregateIterator ();
+  while (i.HasNext ())
+    {
+      CollectMemoryObject (i.Next (), seen, objects);
+    }
+}
+
+/**
+ * Writes the bytes held by each node per component as CSV, the row of node
+ * "none" holding what no node owns, followed by the peak of array
+ * allocations, which in ns-3 are packet buffers and their byte tags, and
+ * by the number and bytes of the objects of each TypeId reachable from the
+ * nodes: their aggregates, devices with the wifi PHY, MAC and station
+ * manager, applications, and the energy sources with their device models.
+ * Those bytes are the blocks of the objects alone, not what they allocate
+ * in turn, which stays with the component.  Returns the mean bytes held
+ * per node.
+ */
+static double
+WriteMemoryReport (std::ostream &os, const NodeContainer &c, const EnergySourceContainer &sources)
+{
+  t_memoryBusy = true;
+  std::set<const void *> seen;
+  std::vector<Ptr<const Object> > objects;
+  for (uint32_t i = 0; i < c.GetN (); i++)
+    {
+      Ptr<Node> node = c.Get (i);
+      CollectMemoryObject (node, seen, objects);
+      for (uint32_t j = 0; j < node->GetNDevices (); j++)
+        {
+          CollectMemoryObject (node->GetDevice (j), seen, objects);
+          Ptr<WifiNetDevice> wifi = DynamicCast<WifiNetDevice> (node->GetDevice (j));
+          if (wifi != 0)
+            {
+              CollectMemoryObject (wifi->GetPhy (), seen, objects);
+              CollectMemoryObject (wifi->GetMac (), seen, objects);
+              CollectMemoryObject (wifi->GetRemoteStationManager (), seen, objects);
+            }
+        }
+      for (uint32_t j = 0; j < node->GetNApplications (); j++)
+        {
+          CollectMemoryObject (node->GetApplication (j), seen, objects);
+        }
+    }
+  for (uint32_t i = 0; i < sources.GetN (); i++)
+    {
+      CollectMemoryObject (sources.Get (i), seen, objects);
+      DeviceEnergyModelContainer models = sources.Get (i)->FindDeviceEnergyModels ("ns3::WifiRadioEnergyModel");
+      for (uint32_t j = 0; j < models.GetN (); j++)
+        {
+          CollectMemoryObject (models.Get (j), seen, objects);
+        }
+    }
+  uint32_t nodes = c.GetN ();
+  std::lock_guard<std::mutex> lock (g_memoryMutex);
+  g_memoryBytes->resize (std::max<size_t> (g_memoryBytes->size (), (nodes + 1) * MEMORY_COMPONENTS), 0);
+  os << "node";
+  for (uint32_t k = 0; k < MEMORY_COMPONENTS; k++)
+    {
+      os << "," << g_memoryComponentNames[k];
+    }
+  os << ",total" << std::endl;
+  int64_t nodeTotal = 0;
+  for (uint32_t i = 0; i <= nodes; i++)
+    {
+      const int64_t *bytes = &(*g_memoryBytes)[i * MEMORY_COMPONENTS];
+      int64_t total = 0;
+      os << (i == 0 ? "none" : std::to_string (i - 1));
+      for (uint32_t k = 0; k < MEMORY_COMPONENTS; k++)
+        {
+          os << "," << bytes[k];
+          total += bytes[k];
+        }
+      os << "," << total << std::endl;
+      nodeTotal += i == 0 ? 0 : total;
+    }
+  os << "# peak packet buffers: " << g_memoryArrayPeakBlocks << " blocks, "
+     << g_memoryArrayPeak << " bytes" << std::endl;
+  std::map<std::string, std::pair<uint64_t, int64_t> > types; ///< objects and bytes by TypeId name
+  for (std::vector<Ptr<const Object> >::const_iterator i = objects.begin (); i != objects.end (); ++i)
+    {
+      std::pair<uint64_t, int64_t> &type = types[(*i)->GetInstanceTypeId ().GetName ()];
+      std::unordered_map<void *, MemoryTag>::const_iterator tag
+        = g_memoryTags->find (const_cast<void *> (dynamic_cast<const void *> (PeekPointer (*i))));
+      type.first++;
+      type.second += tag != g_memoryTags->end () ? tag->second.size : 0;
+    }
+  for (std::map<std::string, std::pair<uint64_t, int64_t> >::const_iterator i = types.begin ();
+       i != types.end (); ++i)
+    {
+      os << "# " << i->first << ": " << i->second.first << " objects, " << i->second.second << " bytes" << std::endl;
+    }
+  t_memoryBusy = false;
+  return nodes == 0 ? 0.0 : static_cast<double> (nodeTotal) / nodes;
+}
+
+/***************************************************************************/
+
+/** Live metrics **/
+/***************************************************************************/
+
+/// Progress of a configuration in a LiveMetricsPage.
+enum LiveState
+{
+  LIVE_PENDING,
+  LIVE_RUNNING,
+  LIVE_DONE,
+  LIVE_CACHED,                ///< loaded from the result cache
+  LIVE_STATES
+};
+
+static const char *g_liveStateNames[LIVE_STATES] = { "pending", "running", "done", "cached" };
+
+/// Counters of one configuration as published to a LiveMetricsPage.
+struct LiveMetrics
+{
+  std::string config;
+  uint32_t state;             ///< a LiveState
+  double updated;             ///< wall clock seconds since the epoch
+  double simTime;             ///< seconds
+  uint64_t events;
+  double eventsPerSecond;     ///< over the last publishing interval
+  uint64_t queueSize;         ///< events in the DepthTrackingScheduler
+  std::vector<uint64_t> sinkBytes;  ///< received by the sinks of each node
+  std::vector<double> energy; ///< J remaining at each node
+};
+
+/**
+ * Memory-mapped file holding the live counters of every configuration of a
+ * sweep, one slot per configuration.  The mapping is shared, so forked
+ * workers publish into the slots of the parent's page.  Each slot is a
+ * seqlock with a single writer: the simulation never waits on a monitor,
+ * which retries a read that overlapped a Publish.
+ */
+class LiveMetricsPage
+{
+public:
+  LiveMetricsPage ();
+  ~LiveMetricsPage ();
+  /// Creates path with a pending slot per configuration, each with room for nodes nodes.
+  void Create (std::string path, const std::vector<std::string> &configs, uint32_t nodes);
+  /// Maps an existing page read-only.
+  void Open (std::string path);
+  uint32_t GetSlots (void) const;
+  /// Slot of the configuration, aborts if the page has none.
+  uint32_t FindSlot (std::string config) const;
+  void Publish (uint32_t slot, const LiveMetrics &metrics);
+  void Read (uint32_t slot, LiveMetrics &metrics) const;
+private:
+  /// File header.
+  struct Header
+  {
+    char magic[8];
+    uint32_t slots;
+    uint32_t nodes;
+    uint64_t slotSize;        ///< bytes, a multiple of 64
+  };
+  /// Fixed part of a slot, followed by sinkBytes[nodes] and energy[nodes].
+  struct Slot
+  {
+    std::atomic<uint32_t> sequence;   ///< odd while the slot is written
+    uint32_t state;
+    char config[64];
+    double updated;
+    double simTime;
+    uint64_t events;
+    double eventsPerSecond;
+    uint64_t queueSize;
+  };
+
+  Slot *GetSlot (uint32_t slot) const;
+  void Map (int fd, size_t size, bool writable);
+
+  char *m_base;
+  size_t m_size;
+  Header *m_header;
+};
+
+LiveMetricsPage::LiveMetricsPage ()
+  : m_base (0),
+    m_size (0),
+    m_header (0)
+{
+}
+
+LiveMetricsPage::~LiveMetricsPage ()
+{
+  if (m_base != 0)
+    {
+      munmap (m_base, m_size);
+    }
+}
+
+void
+LiveMetricsPage::Map (int fd, size_t size, bool writable)
+{
+  void *base = mmap (0, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  NS_ABORT_MSG_IF (base == MAP_FAILED, "mmap failed: " << std::strerror (errno));
+  close (fd);
+  m_base = static_cast<char *> (base);
+  m_size = size;
+  m_header = reinterpret_cast<Header *> (m_base);
+}
+
+void
+LiveMetricsPage::Create (std::string path, const std::vector<std::string> &configs, uint32_t nodes)
+{
+  NS_ABORT_MSG_IF (ATOMIC_INT_LOCK_FREE != 2, "Live metrics need lock-free atomics");
+  uint64_t slotSize = (sizeof (Slot) + nodes * (sizeof (uint64_t) + sizeof (double)) + 63) / 64 * 64;
+  size_t size = 64 + configs.size () * slotSize;
+  int fd = open (path.c_str (), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  NS_ABORT_MSG_IF (fd < 0, "Cannot create " << path << ": " << std::strerror (errno));
+  NS_ABORT_MSG_IF (ftruncate (fd, size) != 0, "Cannot size " << path << ": " << std::strerror (errno));
+  Map (fd, size, true);
+  m_header->slots = configs.size ();
+  m_header->nodes = nodes;
+  m_header->slotSize = slotSize;
+  for (uint32_t i = 0; i < configs.size (); i++)
+    {
+      Slot *slot = new (GetSlot (i)) Slot ();
+      slot->sequence.store (0, std::memory_order_relaxed);
+      slot->state = LIVE_PENDING;
+      std::strncpy (slot->config, configs[i].c_str (), sizeof (slot->config) - 1);
+    }
+  // a monitor opening the file too early sees no magic yet
+  std::atomic_thread_fence (std::memory_order_release);
+  std::memcpy (m_header->magic, "S2LIVE01", 8);
+}
+
+void
+LiveMetricsPage::Open (std::string path)
+{
+  int fd = open (path.c_str (), O_RDONLY);
+  NS_ABORT_MSG_IF (fd < 0, "Cannot open " << path << ": " << std::strerror (errno));
+  struct stat st;
+  NS_ABORT_MSG_IF (fstat (fd, &st) != 0 || st.st_size < 64, path << " is not a metrics page");
+  Map (fd, st.st_size, false);
+  NS_ABORT_MSG_IF (std::memcmp (m_header->magic, "S2LIVE01", 8) != 0, path << " is not a metrics page");
+  std::atomic_thread_fence (std::memory_order_acquire);
+  NS_ABORT_MSG_IF (64 + m_header->slots * m_header->slotSize > m_size, path << " is truncated");
+}
+
+uint32_t
+LiveMetricsPage::GetSlots (void) const
+{
+  return m_header->slots;
+}
+
+LiveMetricsPage::Slot *
+LiveMetricsPage::GetSlot (uint32_t slot) const
+{
+  NS_ASSERT (slot < m_header->slots);
+  return reinterpret_cast<Slot *> (m_base + 64 + slot * m_header->slotSize);
+}
+
+uint32_t
+LiveMetricsPage::FindSlot (std::string config) const
+{
+  for (uint32_t i = 0; i < m_header->slots; i++)
+    {
+      if (config == GetSlot (i)->config)
+        {
+          return i;
+        }
+    }
+  NS_FATAL_ERROR ("No metrics slot for " << config);
+  return 0;
+}
+
+void
+LiveMetricsPage::Publish (uint32_t slot, const LiveMetrics &metrics)
+{
+  Slot *s = GetSlot (slot);
+  uint32_t sequence = s->sequence.load (std::memory_order_relaxed);
+  s->sequence.store (sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence (std::memory_order_release);
+  s->state = metrics.state;
+  s->updated = metrics.updated;
+  s->simTime = metrics.simTime;
+  s->events = metrics.events;
+  s->eventsPerSecond = metrics.eventsPerSecond;
+  s->queueSize = metrics.queueSize;
+  uint32_t nodes = m_header->nodes;
+  uint64_t *sinkBytes = reinterpret_cast<uint64_t *> (s + 1);
+  double *energy = reinterpret_cast<double *> (sinkBytes + nodes);
+  std::memcpy (sinkBytes, metrics.sinkBytes.data (),
+               std::min<size_t> (nodes, metrics.sinkBytes.size ()) * sizeof (uint64_t));
+  std::memcpy (energy, metrics.energy.data (), std::min<size_t> (nodes, metrics.energy.size ()) * sizeof (double));
+  s->sequence.store (sequence + 2, std::memory_order_release);
+}
+
+void
+LiveMetricsPage::Read (uint32_t slot, LiveMetrics &metrics) const
+{
+  const Slot *s = GetSlot (slot);
+  std::vector<char> copy (m_header->slotSize);
+  while (true)
+    {
+      uint32_t sequence = s->sequence.load (std::memory_order_acquire);
+      if (sequence & 1)
+        {
+          std::this_thread::yield ();
+          continue;
+        }
+      std::memcpy (&copy[0], s, copy.size ());
+      std::atomic_thread_fence (std::memory_order_acquire);
+      if (s->sequence.load (std::memory_order_relaxed) == sequence)
+        {
+          break;
+        }
+    }
+  const Slot *c = reinterpret_cast<const Slot *> (&copy[0]);
+  uint32_t nodes = m_header->nodes;
+  const uint64_t *sinkBytes = reinterpret_cast<const uint64_t *> (c + 1);
+  const double *energy = reinterpret_cast<const double *> (sinkBytes + nodes);
+  metrics.config.assign (c->config, strnlen (c->config, sizeof (c->config)));
+  metrics.state = c->state;
+  metrics.updated = c->updated;
+  metrics.simTime = c->simTime;
+  metrics.events = c->events;
+  metrics.eventsPerSecond = c->eventsPerSecond;
+  metrics.queueSize = c->queueSize;
+  metrics.sinkBytes.assign (sinkBytes, sinkBytes + nodes);
+  metrics.energy.assign (energy, energy + nodes);
+}
+
+/// Trace function keeping the remaining energy of node index for LiveMetrics.
+static void
+RecordLiveEnergy (std::vector<double> *energy, uint32_t index, double oldValue, double remainingEnergy)
+{
+  (*energy)[index] = remainingEnergy;
+}
+
+/**
+ * Prints a line per configuration of the page at path every period seconds
+ * until no configuration is pending or running, once if period is 0.  The
+ * age of a running configuration is the wall time since it last published:
+ * a run that stops advancing in simulated time stops publishing.
+ */
+static void
+MonitorMetricsPage (std::string path, double period, std::ostream &os)
+{
+  LiveMetricsPage page;
+  page.Open (path);
+  LiveMetrics metrics;
+  bool active = true;
+  while (active)
+    {
+      double now = std::chrono::duration<double> (std::chrono::system_clock::now ().time_since_epoch ()).count ();
+      os << std::left << std::setw (12) << "config" << std::right << std::setw (9) << "state"
+         << std::setw (10) << "sim (s)" << std::setw (12) << "events/s" << std::setw (10) << "queue"
+         << std::setw (12) << "sink bytes" << std::setw (14) << "min energy" << std::setw (9) << "age (s)"
+         << std::endl;
+      active = false;
+      for (uint32_t i = 0; i < page.GetSlots (); i++)
+        {
+          page.Read (i, metrics);
+          uint64_t bytes = 0;
+          for (uint32_t j = 0; j < metrics.sinkBytes.size (); j++)
+            {
+              bytes += metrics.sinkBytes[j];
+            }
+          double energy = metrics.energy.empty () ? 0.0
+            : *std::min_element (metrics.energy.begin (), metrics.energy.end ());
+          os << std::left << std::setw (12) << metrics.config << std::right << std::setw (9)
+             << (metrics.state < LIVE_STATES ? g_liveStateNames[metrics.state] : "unknown");
+          if (metrics.state == LIVE_RUNNING || metrics.state == LIVE_DONE)
+            {
+              os << std::fixed << std::setprecision (2) << std::setw (10) << metrics.simTime
+                 << std::setprecision (0) << std::setw (12) << metrics.eventsPerSecond
+                 << std::setw (10) << metrics.queueSize << std::setw (12) << bytes
+                 << std::setprecision (3) << std::setw (14) << energy
+                 << std::setprecision (1) << std::setw (9) << (metrics.state == LIVE_RUNNING ? now - metrics.updated : 0.0)
+                 << std::defaultfloat;
+            }
+          os << std::endl;
+          active = active || metrics.state == LIVE_PENDING || metrics.state == LIVE_RUNNING;
+        }
+      if (period <= 0)
+        {
+          break;
+        }
+      os << std::endl;
+      if (active)
+        {
+          std::this_thread::sleep_for (std::chrono::duration<double> (period));
+        }
+    }
+}
+
+/***************************************************************************/
+
+/** Delay statistics **/
+/***************************************************************************/
+
+/**
+ * Log-linear histogram of durations in nanoseconds, in the manner of
+ * HdrHistogram: exact below 64 ns, then 32 buckets per power of two, so that
+ * a quantile is within 1/64 of the true value.  Values from 2^36 ns (about
+ * 69 s) on share the last bucket.  The buckets take 4 KiB, allocated by the
+ * first value, however many values are added, and two histograms merge by
+ * adding their buckets.
+ */
+class DelayHistogram
+{
+public:
+  DelayHistogram ();
+  void Add (uint64_t ns);
+  void Merge (const DelayHistogram &other);
+  uint64_t GetCount (void) const;
+  /// Mean in nanoseconds, 0 when empty.
+  double GetMean (void) const;
+  /// Value in nanoseconds that a fraction q of the values do not exceed, 0 when empty.
+  double GetQuantile (double q) const;
+  void Encode (std::string &buffer) const;
+  void Decode (const std::string &buffer, size_t &offset);
+private:
+  static const uint32_t BUCKETS = 1024;
+  static uint32_t GetBucket (uint64_t ns);
+  /// Middle of the values counted by bucket.
+  static double GetMiddle (uint32_t bucket);
+
+  std::vector<uint32_t> m_counts;   ///< empty until the first value
+  uint64_t m_count;
+  uint64_t m_min;
+  uint64_t m_max;
+  double m_sum;
+};
+
+const uint32_t DelayHistogram::BUCKETS;
+
+DelayHistogram::DelayHistogram ()
+  : m_count (0),
+    m_min (std::numeric_limits<uint64_t>::max ()),
+    m_max (0),
+    m_sum (0.0)
+{
+}
+
+uint32_t
+DelayHistogram::GetBucket (uint64_t ns)
+{
+  if (ns < 64)
+    {
+      return ns;
+    }
+  ns = std::min<uint64_t> (ns, (uint64_t (1) << 36) - 1);
+  uint32_t shift = 63 - __builtin_clzll (ns) - 5;
+  return shift * 32 + (ns >> shift);
+}
+
+double
+DelayHistogram::GetMiddle (uint32_t bucket)
+{
+  if (bucket < 64)
+    {
+      return bucket;
+    }
+  uint32_t shift = bucket / 32 - 1;
+  uint64_t lowest = uint64_t (bucket - shift * 32) << shift;
+  return lowest + ((uint64_t (1) << shift) - 1) / 2.0;
+}
+
+void
+DelayHistogram::Add (uint64_t ns)
+{
+  if (m_counts.empty ())
+    {
+      m_counts.assign (BUCKETS, 0);
+    }
+  m_counts[GetBucket (ns)]++;
+  m_count++;
+  m_min = std::min (m_min, ns);
+  m_max = std::max (m_max, ns);
+  m_sum += ns;
+}
+
+void
+DelayHistogram::Merge (const DelayHistogram &other)
+{
+  if (other.m_count == 0)
+    {
+      return;
+    }
+  if (m_counts.empty ())
+    {
+      m_counts.assign (BUCKETS, 0);
+    }
+  for (uint32_t i = 0; i < BUCKETS; i++)
+    {
+      m_counts[i] += other.m_counts[i];
+    }
+  m_count += other.m_count;
+  m_min = std::min (m_min, other.m_min);
+  m_max = std::max (m_max, other.m_max);
+  m_sum += other.m_sum;
+}
+
+uint64_t
+DelayHistogram::GetCount (void) const
+{
+  return m_count;
+}
+
+double
+DelayHistogram::GetMean (void) const
+{
+  return m_count == 0 ? 0.0 : m_sum / m_count;
+}
+
+double
+DelayHistogram::GetQuantile (double q) const
+{
+  if (m_count == 0)
+    {
+      return 0.0;
+    }
+  uint64_t rank = std::max<uint64_t> (1, std::ceil (q * m_count));
+  if (rank >= m_count)
+    {
+      return m_max;
+    }
+  uint64_t seen = 0;
+  uint32_t bucket = 0;
+  while (seen + m_counts[bucket] < rank && bucket + 1 < BUCKETS)
+    {
+      seen += m_counts[bucket++];
+    }
+  // the smallest value is exact too
+  return std::max<double> (m_min, std::min<double> (m_max, GetMiddle (bucket)));
+}
+
+/// Byte tag carrying the time an application sent a packet.
+class SendTimeTag : public Tag
+{
+public:
+  static TypeId GetTypeId (void);
+  virtual TypeId GetInstanceTypeId (void) const;
+  SendTimeTag ();
+  SendTimeTag (Time sent);
+  Time GetSendTime (void) const;
+
+  virtual uint32_t GetSerializedSize (void) const;
+  virtual void Serialize (TagBuffer i) const;
+  virtual void Deserialize (TagBuffer i);
+  virtual void Print (std::ostream &os) const;
+private:
+  int64_t m_sent;             ///< ns
+};
+
+NS_OBJECT_ENSURE_REGISTERED (SendTimeTag);
+
+TypeId
+SendTimeTag::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::SendTimeTag")
+    .SetParent<Tag> ()
+    .AddConstructor<SendTimeTag> ()
+  ;
+  return tid;
+}
+
+TypeId
+SendTimeTag::GetInstanceTypeId (void) const
+{
+  return GetTypeId ();
+}
+
+SendTimeTag::SendTimeTag ()
+  : m_sent (0)
+{
+}
+
+SendTimeTag::SendTimeTag (Time sent)
+  : m_sent (sent.GetNanoSeconds ())
+{
+}
+
+Time
+SendTimeTag::GetSendTime (void) const
+{
+  return NanoSeconds (m_sent);
+}
+
+uint32_t
+SendTimeTag::GetSerializedSize (void) const
+{
+  return sizeof (m_sent);
+}
+
+void
+SendTimeTag::Serialize (TagBuffer i) const
+{
+  i.WriteU64 (m_sent);
+}
+
+void
+SendTimeTag::Deserialize (TagBuffer i)
+{
+  m_sent = i.ReadU64 ();
+}
+
+void
+SendTimeTag::Print (std::ostream &os) const
+{
+  os << "sent=" << m_sent << "ns";
+}
+
+/// Tx trace of the OnOff applications: stamps every packet with the time it is sent.
+static void
+StampSendTime (Ptr<const Packet> packet)
+{
+  packet->AddByteTag (SendTimeTag (Simulator::Now ()));
+}
+
+/***************************************************************************/
+
+/** Scenario **/
+/***************************************************************************/
+
+/// A node of the scenario.
+struct ScenarioNode
+{
+  Vector position;
+  double advanceStart;        ///< first scripted mobility step in seconds, negative if the node never moves
+};
+
+/// A constant rate OnOff flow between the wifi devices of two nodes.
+struct ScenarioFlow
+{
+  uint32_t source;
+  uint32_t destination;
+  uint16_t protocol;
+  uint64_t rate;              ///< bit/s
+  uint32_t packetSize;        ///< bytes
+  double start;               ///< seconds
+  double stop;                ///< seconds
+};
+
+/// Topology, traffic and energy parameters of an Experiment.
+struct Scenario
+{
+  std::vector<ScenarioNode> nodes;
+  std::vector<ScenarioFlow> flows;
+  std::vector<uint32_t> sinks;  ///< nodes with a packet sink socket, one socket per entry
+  double initialEnergy;         ///< J, of every BasicEnergySource
+  double txCurrent;             ///< A, of every WifiRadioEnergyModel
+};
+
+/***************************************************************************/
+
+/// UDP port of the flows with protocol 0 in OLSR mode; protocol p uses UDP_PORT_BASE + p.
+static const uint16_t UDP_PORT_BASE = 9;
+
+class Experiment
+{
+public:
+  /// (x, y) points in the order they were added to the dataset.
+  typedef std::vector<std::pair<double, double> > Samples;
+
+  /// Cost of the last run.
+  struct RunStats
+  {
+    double setupSeconds;      ///< wall time building the scenario
+    double runSeconds;        ///< wall time in Simulator::Run
+    uint64_t events;          ///< events executed
+    uint64_t packets;         ///< packets received by the sinks
+  };
+
+  Experiment ();
+  Experiment (std::string name);
+  Gnuplot2dDataset Run (const Scenario &scenario, const WifiHelper &wifi, const YansWifiPhyHelper &wifiPhy,
+                        const WifiMacHelper &wifiMac, const YansWifiChannelHelper &wifiChannel);
+  const Samples &GetSamples (void) const;
+  /// Records the energy traces of every node into a binary trace file instead of logging node 1.
+  void SetTraceFile (std::string path);
+  /// Sets the period of the throughput sampler.
+  void SetSampleInterval (Time interval);
+  /// Keeps the per-sink and per-flow byte counters of every sample for WriteFlowStats.
+  void SetFlowStats (bool keep);
+  /// Writes the per-sink and per-flow byte counters of every sample as CSV.
+  void WriteFlowStats (std::string path) const;
+  /// Ends the run as soon as the throughput series has converged.
+  void EnableConvergenceControl (const ConvergenceController &controller);
+  /// Simulation time at which the last run stopped.
+  Time GetStopTime (void) const;
+  /// Why the last run stopped: "traffic end", "converged" or "branched".
+  std::string GetStopReason (void) const;
+  /// Integrates energy on radio state changes instead of periodically.
+  void SetLazyEnergy (bool lazy);
+  /**
+   * Counts what the sinks receive from the receive notification of their
+   * node instead of dequeuing packet copies from packet sockets.
+   */
+  void SetCountingSinks (bool counting);
+  /**
+   * Routes the flows over UDP/IPv4 with OLSR when "olsr", sends them one
+   * hop over packet sockets when "none".  OLSR is ns-3's stock protocol,
+   * which recomputes its whole routing table on every topology change.
+   */
+  void SetRouting (std::string routing);
+  /// Writes the memory held per node and component when the run ends; needs EnableMemoryAccounting.
+  void SetMemoryReport (std::string path);
+  /// Mean bytes held per node when the last run ended, 0 without memory accounting.
+  double GetMemoryPerNode (void) const;
+  /**
+   * Streams the samples to a series file instead of keeping them in
+   * memory, writing the extremes of every bucketSize samples only.
+   */
+  void SetSeriesFile (std::string path, uint32_t bucketSize);
+  /**
+   * Publishes the counters of every run to slot of page, every interval of
+   * simulated time, for a monitor in another process.
+   */
+  void SetLiveMetrics (LiveMetricsPage *page, uint32_t slot, Time interval);
+  /**
+   * Calls branch with the wifi devices at the first instant from at on with
+   * no frame in flight: every frame handed to a MAC was reported by the
+   * MAC as acknowledged, failed or dropped, and every PHY is idle, so that
+   * no station manager has an outcome to hear about.  The run goes on if
+   * branch returns true and stops as "branched" if it returns false; it
+   * aborts if no such instant comes within a second.  BranchTestCase
+   * checks branches against each other and against a run from scratch.
+   */
+  void SetBranchPoint (Time at, std::function<bool (NetDeviceContainer)> branch);
+  /// Stamps the packets of the flows with their send time to measure their delay at the sinks.
+  void SetDelayStats (bool enable);
+  /// One-way delay of the packets received from each flow, empty without delay stats.
+  const std::vector<DelayHistogram> &GetFlowDelays (void) const;
+  /// Delay variation between consecutive packets received from each flow, empty without delay stats.
+  const std::vector<DelayHistogram> &GetFlowJitter (void) const;
+  /// Records the energy left at every node when the run stops and when each battery drained.
+  void SetEnergyReport (bool enable);
+  /// J remaining at each node when the last run stopped, empty without an energy report.
+  const std::vector<double> &GetFinalEnergy (void) const;
+  /// Seconds at which the battery of each node was found drained, -1 if never, empty without an energy report.
+  const std::vector<double> &GetDepletionTimes (void) const;
+  const RunStats &GetRunStats (void) const;
+private:
+  void AddSample (double x, double y);
+  void Sample (void);
+  void ReceivePacket (Ptr<Socket> socket);
+  void ReceiveDatagram (Ptr<Socket> socket);
+  void CountPacket (Ptr<NetDevice> device, Ptr<const Packet> packet, uint16_t protocol,
+                    const Address &from, const Address &to, NetDevice::PacketType packetType);
+  void CountReceived (uint32_t sink, Ptr<const Packet> packet, Mac48Address source, uint16_t protocol);
+  void RecordDelay (uint32_t flow, Ptr<const Packet> packet);
+  static void RecordDepletion (Experiment *experiment, uint32_t index, double oldValue, double remaining);
+  void ReadFinalEnergy (void);
+  Ptr<Socket> SetupPacketReceive (Ptr<Node> node);
+  Ptr<Socket> SetupDatagramReceive (Ptr<Node> node, uint16_t protocol);
+  void PublishMetrics (LiveState state);
+  void PublishPeriodically (void);
+  void Branch (NetDeviceContainer devices);
+  static void TrackFrameQueued (Experiment *experiment, uint32_t device, Ptr<const Packet> packet);
+  static void TrackFrameDropped (Experiment *experiment, uint32_t device, Ptr<const Packet> packet);
+  static void TrackFrameDone (Experiment *experiment, uint32_t device, const WifiMacHeader &header);
+  bool IsIdle (NetDeviceContainer devices) const;
+
+  uint64_t m_bytesTotal;
+  uint64_t m_packetsTotal;
+  uint64_t m_sampledBytesTotal;       ///< m_bytesTotal at the previous sample
+  uint32_t m_firstNodeId;
+  /// Flow of a (source address, receiving node, protocol) triple.
+  std::map<std::tuple<Mac48Address, uint32_t, uint16_t>, uint32_t> m_flowIds;
+  std::map<Ipv4Address, Mac48Address> m_ipv4Owners; ///< wifi device holding each address in OLSR mode
+  std::vector<uint32_t> m_sinkCopies; ///< sink entries of each node
+  std::vector<uint64_t> m_sinkBytes;  ///< bytes received by the sinks of each node
+  std::vector<uint64_t> m_flowBytes;  ///< bytes received from each flow
+  Time m_sampleInterval;
+  Time m_stopTime;
+  bool m_flowStats;
+  std::vector<double> m_sampleTimes;
+  std::vector<uint64_t> m_sinkSeries; ///< m_sinkBytes at each sample, one row per sample
+  std::vector<uint64_t> m_flowSeries; ///< m_flowBytes at each sample, one row per sample
+  bool m_convergenceControl;
+  ConvergenceController m_convergence;
+  bool m_lazyEnergy;
+  bool m_countingSinks;
+  std::string m_routing;
+  std::string m_memoryReport;
+  double m_memoryPerNode;
+  Time m_energyUpdateInterval;
+  LazyEnergyAccounting m_lazyEnergyAccounting;
+  RunStats m_runStats;
+  Time m_stoppedAt;
+  std::string m_stopReason;
+  BatchedMobility m_mobility;
+  Gnuplot2dDataset m_output;
+  Samples m_samples;
+  std::string m_traceFile;
+  std::string m_seriesFile;
+  uint32_t m_seriesBucket;
+  SeriesWriter m_series;
+  LiveMetricsPage *m_livePage;
+  uint32_t m_liveSlot;
+  Time m_liveInterval;
+  LiveMetrics m_live;
+  std::chrono::steady_clock::time_point m_livePublished;   ///< wall time of the previous publication
+  Time m_branchAt;
+  std::vector<int64_t> m_framesInFlight;  ///< frames handed to each MAC and not acknowledged, failed or dropped yet
+  std::function<bool (NetDeviceContainer)> m_branch;
+  bool m_delayStats;
+  std::vector<DelayHistogram> m_flowDelays;
+  std::vector<DelayHistogram> m_flowJitter;
+  std::vector<int64_t> m_lastDelays;  ///< ns, of the last packet received from each flow
+  std::vector<uint64_t> m_lastUids;   ///< of the last packet received from each flow
+  bool m_energyReport;
+  EnergySourceContainer m_energySources;
+  std::vector<double> m_finalEnergy;
+  std::vector<double> m_depletionLevels; ///< J at which each battery counts as drained
+  std::vector<double> m_depletionTimes;
+};
+
+Experiment::Experiment ()
+  : m_sampleInterval (Seconds (1.5)),
+    m_flowStats (false),
+    m_convergenceControl (false),
+    m_lazyEnergy (false),
+    m_countingSinks (false),
+    m_routing ("none"),
+    m_memoryPerNode (0.0),
+    m_energyUpdateInterval (Seconds (1.0)),
+    m_seriesBucket (1),
+    m_livePage (0),
+    m_liveSlot (0),
+    m_delayStats (false),
+    m_energyReport (false)
+{
+}
+
+Experiment::Experiment (std::string name)
+  : m_sampleInterval (Seconds (1.5)),
+    m_flowStats (false),
+    m_convergenceControl (false),
+    m_lazyEnergy (false),
+    m_countingSinks (false),
+    m_routing ("none"),
+    m_memoryPerNode (0.0),
+    m_energyUpdateInterval (Seconds (1.0)),
+    m_output (name),
+    m_seriesBucket (1),
+    m_livePage (0),
+    m_liveSlot (0),
+    m_delayStats (false),
+    m_energyReport (false)
+{
+  m_output.SetStyle (Gnuplot2dDataset::LINES);
+}
+
+const Experiment::Samples &
+Experiment::GetSamples (void) const
+{
+  return m_samples;
+}
+
+void
+Experiment::SetSeriesFile (std::string path, uint32_t bucketSize)
+{
+  m_seriesFile = path;
+  m_seriesBucket = bucketSize;
+}
+
+void
+Experiment::SetLiveMetrics (LiveMetricsPage *page, uint32_t slot, Time interval)
+{
+  m_livePage = page;
+  m_liveSlot = slot;
+  m_liveInterval = interval;
+}
+
+void
+Experiment::SetBranchPoint (Time at, std::function<bool (NetDeviceContainer)> branch)
+{
+  m_branchAt = at;
+  m_branch = branch;
+}
+
+void
+Experiment::SetDelayStats (bool enable)
+{
+  m_delayStats = enable;
+}
+
+const std::vector<DelayHistogram> &
+Experiment::GetFlowDelays (void) const
+{
+  return m_flowDelays;
+}
+
+const std::vector<DelayHistogram> &
+Experiment::GetFlowJitter (void) const
+{
+  return m_flowJitter;
+}
+
+void
+Experiment::SetEnergyReport (bool enable)
+{
+  m_energyReport = enable;
+}
+
+const std::vector<double> &
+Experiment::GetFinalEnergy (void) const
+{
+  return m_finalEnergy;
+}
+
+const std::vector<double> &
+Experiment::GetDepletionTimes (void) const
+{
+  return m_depletionTimes;
+}
+
+/// RemainingEnergy trace: the update that first goes down to the low battery threshold drains the battery.
+void
+Experiment::RecordDepletion (Experiment *experiment, uint32_t index, double oldValue, double remaining)
+{
+  if (experiment->m_depletionTimes[index] < 0 && remaining <= experiment->m_depletionLevels[index])
+    {
+      experiment->m_depletionTimes[index] = Simulator::Now ().GetSeconds ();
+    }
+}
+
+/// Reads every source while the simulation still runs: a stopped simulator no longer integrates.
+void
+Experiment::ReadFinalEnergy (void)
+{
+  m_finalEnergy.clear ();
+  for (uint32_t i = 0; i < m_energySources.GetN (); i++)
+    {
+      m_finalEnergy.push_back (m_energySources.Get (i)->GetRemainingEnergy ());
+    }
+}
+
+void
+Experiment::SetTraceFile (std::string path)
+{
+  m_traceFile = path;
+}
+
+void
+Experiment::SetSampleInterval (Time interval)
+{
+  m_sampleInterval = interval;
+}
+
+void
+Experiment::EnableConvergenceControl (const ConvergenceController &controller)
+{
+  m_convergenceControl = true;
+  m_convergence = controller;
+}
+
+void
+Experiment::SetLazyEnergy (bool lazy)
+{
+  m_lazyEnergy = lazy;
+}
+
+void
+Experiment::SetCountingSinks (bool counting)
+{
+  m_countingSinks = counting;
+}
+
+void
+Experiment::SetMemoryReport (std::string path)
+{
+  m_memoryReport = path;
+}
+
+double
+Experiment::GetMemoryPerNode (void) const
+{
+  return m_memoryPerNode;
+}
+
+void
+Experiment::SetRouting (std::string routing)
+{
+  NS_ABORT_MSG_IF (routing != "none" && routing != "olsr", "Unknown routing " << routing);
+  m_routing = routing;
+}
+
+const Experiment::RunStats &
+Experiment::GetRunStats (void) const
+{
+  return m_runStats;
+}
+
+Time
+Experiment::GetStopTime (void) const
+{
+  return m_stoppedAt;
+}
+
+std::string
+Experiment::GetStopReason (void) const
+{
+  return m_stopReason;
+}
+
+void
+Experiment::SetFlowStats (bool keep)
+{
+  m_flowStats = keep;
+}
+
+void
+Experiment::WriteFlowStats (std::string path) const
+{
+  NS_ASSERT (m_flowStats);
+  std::ofstream out (path.c_str ());
+  NS_ABORT_MSG_IF (!out, "Cannot create " << path);
+  out << "time,kind,id,bytes" << std::endl;
+  for (uint32_t k = 0; k < m_sampleTimes.size (); k++)
+    {
+      for (uint32_t i = 0; i < m_sinkBytes.size (); i++)
+        {
+          uint64_t bytes = m_sinkSeries[k * m_sinkBytes.size () + i];
+          if (bytes != 0)
+            {
+              out << m_sampleTimes[k] << ",sink," << i << "," << bytes << std::endl;
+            }
+        }
+      for (uint32_t i = 0; i < m_flowBytes.size (); i++)
+        {
+          out << m_sampleTimes[k] << ",flow," << i << "," << m_flowSeries[k * m_flowBytes.size () + i] << std::endl;
+        }
+    }
+}
+
+void
+Experiment::AddSample (double x, double y)
+{
+  if (m_series.IsOpen ())
+    {
+      m_series.Add (x, y);
+      return;
+    }
+  m_output.Add (x, y);
+  m_samples.push_back (std::make_pair (x, y));
+}
+
+/**
+ * Snapshots every counter and adds the aggregate throughput of the last
+ * interval, in Mbit/s, to the dataset.  One sampler event serves all sinks.
+ */
+void
+Experiment::Sample (void)
+{
+  double now = Simulator::Now ().GetSeconds ();
+  double mbs = (((m_bytesTotal - m_sampledBytesTotal) * 8.0) / 1000000) / m_sampleInterval.GetSeconds ();
+  m_sampledBytesTotal = m_bytesTotal;
+  AddSample (now, mbs);
+  if (m_flowStats)
+    {
+      m_sampleTimes.push_back (now);
+      m_sinkSeries.insert (m_sinkSeries.end (), m_sinkBytes.begin (), m_sinkBytes.end ());
+      m_flowSeries.insert (m_flowSeries.end (), m_flowBytes.begin (), m_flowBytes.end ());
+    }
+  if (m_convergenceControl && m_convergence.Add (Simulator::Now (), mbs))
+    {
+      NS_LOG_INFO ("Throughput converged to " << m_convergence.GetMean () << " +- "
+                   << m_convergence.GetHalfWidth () << " Mbit/s at " << now << "s");
+      m_stopReason = "converged";
+      if (m_energyReport)
+        {
+          ReadFinalEnergy ();
+        }
+      Simulator::Stop ();
+      return;
+    }
+  if (Simulator::Now () + m_sampleInterval < m_stopTime)
+    {
+      Simulator::Schedule (m_sampleInterval, &Experiment::Sample, this);
+    }
+}
+
+void
+Experiment::ReceivePacket (Ptr<Socket> socket)
+{
+  uint32_t sink = socket->GetNode ()->GetId () - m_firstNodeId;
+  Ptr<Packet> packet;
+  Address from;
+  while ((packet = socket->RecvFrom (from)))
+    {
+      PacketSocketAddress source = PacketSocketAddress::ConvertFrom (from);
+      CountReceived (sink, packet, Mac48Address::ConvertFrom (source.GetPhysicalAddress ()),
+                     source.GetProtocol ());
+    }
+}
+
+/**
+ * Receive callback of the UDP sink of a node in OLSR mode: the node binds
+ * one socket per flow port, each datagram counts once per sink entry of
+ * the node as a packet socket per entry would.
+ */
+void
+Experiment::ReceiveDatagram (Ptr<Socket> socket)
+{
+  uint32_t sink = socket->GetNode ()->GetId () - m_firstNodeId;
+  Address local;
+  socket->GetSockName (local);
+  uint16_t protocol = InetSocketAddress::ConvertFrom (local).GetPort () - UDP_PORT_BASE;
+  Ptr<Packet> packet;
+  Address from;
+  while ((packet = socket->RecvFrom (from)))
+    {
+      Mac48Address source = m_ipv4Owners[InetSocketAddress::ConvertFrom (from).GetIpv4 ()];
+      for (uint32_t i = 0; i < m_sinkCopies[sink]; i++)
+        {
+          CountReceived (sink, packet, source, protocol);
+        }
+    }
+}
+
+/**
+ * Protocol handler of a counting sink: sees the same packets as a packet
+ * socket bound to every protocol and device, without copying them.
+ */
+void
+Experiment::CountPacket (Ptr<NetDevice> device, Ptr<const Packet> packet, uint16_t protocol,
+                         const Address &from, const Address &to, NetDevice::PacketType packetType)
+{
+  CountReceived (device->GetNode ()->GetId () - m_firstNodeId, packet,
+                 Mac48Address::ConvertFrom (from), protocol);
+}
+
+void
+Experiment::CountReceived (uint32_t sink, Ptr<const Packet> packet, Mac48Address source, uint16_t protocol)
+{
+  uint32_t size = packet->GetSize ();
+  m_bytesTotal += size;
+  m_packetsTotal++;
+  m_sinkBytes[sink] += size;
+  std::map<std::tuple<Mac48Address, uint32_t, uint16_t>, uint32_t>::const_iterator flow =
+    m_flowIds.find (std::make_tuple (source, sink, protocol));
+  if (flow != m_flowIds.end ())
+    {
+      m_flowBytes[flow->second] += size;
+      if (m_delayStats)
+        {
+          RecordDelay (flow->second, packet);
+        }
+    }
+}
+
+/**
+ * Adds the delay of a packet stamped by StampSendTime to the histograms of
+ * its flow.  The jitter is the absolute difference between the delays of
+ * consecutive packets of the flow.
+ */
+void
+Experiment::RecordDelay (uint32_t flow, Ptr<const Packet> packet)
+{
+  SendTimeTag tag;
+  // every sink entry of a node gets its own copy of a packet
+  if (packet->GetUid () == m_lastUids[flow] || !packet->FindFirstMatchingByteTag (tag))
+    {
+      return;
+    }
+  int64_t delay = (Simulator::Now () - tag.GetSendTime ()).GetNanoSeconds ();
+  m_flowDelays[flow].Add (delay);
+  if (m_flowDelays[flow].GetCount () > 1)
+    {
+      m_flowJitter[flow].Add (delay > m_lastDelays[flow] ? delay - m_lastDelays[flow] : m_lastDelays[flow] - delay);
+    }
+  m_lastDelays[flow] = delay;
+  m_lastUids[flow] = packet->GetUid ();
+}
+
+void
+Experiment::PublishMetrics (LiveState state)
+{
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now ();
+  double seconds = std::chrono::duration<double> (now - m_livePublished).count ();
+  uint64_t events = Simulator::GetEventCount ();
+  m_live.state = state;
+  m_live.updated = std::chrono::duration<double> (std::chrono::system_clock::now ().time_since_epoch ()).count ();
+  m_live.simTime = Simulator::Now ().GetSeconds ();
+  m_live.eventsPerSecond = seconds > 0 ? (events - m_live.events) / seconds : 0.0;
+  m_live.events = events;
+  m_live.queueSize = DepthTrackingScheduler::GetDepth ();
+  m_live.sinkBytes = m_sinkBytes;
+  m_livePage->Publish (m_liveSlot, m_live);
+  m_livePublished = now;
+}
+
+void
+Experiment::PublishPeriodically (void)
+{
+  PublishMetrics (LIVE_RUNNING);
+  if (Simulator::Now () + m_liveInterval < m_stopTime)
+    {
+      Simulator::Schedule (m_liveInterval, &Experiment::PublishPeriodically, this);
+    }
+}
+
+void
+Experiment::Branch (NetDeviceContainer devices)
+{
+  if (!IsIdle (devices))
+    {
+      NS_ABORT_MSG_IF (Simulator::Now () >= m_branchAt + Seconds (1.0),
+                       "No instant without frames in flight to branch at in the second after "
+                       << m_branchAt.GetSeconds () << "s");
+      Simulator::Schedule (MicroSeconds (10), &Experiment::Branch, this, devices);
+      return;
+    }
+  NS_LOG_DEBUG ("Branching at " << Simulator::Now ().GetSeconds () << "s");
+  if (!m_branch (devices))
+    {
+      // the branches took over the rest of the run, live metrics slot included
+      m_livePage = 0;
+      m_stopReason = "branched";
+      Simulator::Stop ();
+    }
+}
+
+void
+Experiment::TrackFrameQueued (Experiment *experiment, uint32_t device, Ptr<const Packet> packet)
+{
+  experiment->m_framesInFlight[device]++;
+}
+
+void
+Experiment::TrackFrameDropped (Experiment *experiment, uint32_t device, Ptr<const Packet> packet)
+{
+  experiment->m_framesInFlight[device]--;
+  NS_ABORT_MSG_IF (experiment->m_framesInFlight[device] < 0, "Device " << device << " dropped a frame it was not given");
+}
+
+/// TxOkHeader and TxErrHeader traces: the MAC got the acknowledgement of a frame or gave up on it.
+void
+Experiment::TrackFrameDone (Experiment *experiment, uint32_t device, const WifiMacHeader &header)
+{
+  experiment->m_framesInFlight[device]--;
+  NS_ABORT_MSG_IF (experiment->m_framesInFlight[device] < 0, "Device " << device << " ended a frame it was not given");
+}
+
+bool
+Experiment::IsIdle (NetDeviceContainer devices) const
+{
+  for (uint32_t i = 0; i < devices.GetN (); i++)
+    {
+      if (m_framesInFlight[i] != 0
+          || !DynamicCast<WifiNetDevice> (devices.Get (i))->GetPhy ()->IsStateIdle ())
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+Ptr<Socket>
+Experiment::SetupPacketReceive (Ptr<Node> node)
+{
+  TypeId tid = TypeId::LookupByName ("ns3::PacketSocketFactory");
+  Ptr<Socket> sink = Socket::CreateSocket (node, tid);
+  sink->Bind ();
+  sink->SetRecvCallback (MakeCallback (&Experiment::ReceivePacket, this));
+  return sink;
+}
+
+Ptr<Socket>
+Experiment::SetupDatagramReceive (Ptr<Node> node, uint16_t protocol)
+{
+  Ptr<Socket> sink = Socket::CreateSocket (node, UdpSocketFactory::GetTypeId ());
+  sink->Bind (InetSocketAddress (Ipv4Address::GetAny (), UDP_PORT_BASE + protocol));
+  sink->SetRecvCallback (MakeCallback (&Experiment::ReceiveDatagram, this));
+  return sink;
+}
+/// Trace function for remaining energy at node.
+void
+RemainingEnergy (double oldValue, double remainingEnergy)
+{
+  NS_LOG_UNCOND (Simulator::Now ().GetSeconds ()
+                 << "s Current remaining energy = " << remainingEnergy << "J");
+}
+
+/// Trace function for total energy consumption at node.
+void
+TotalEnergy (double oldValue, double totalEnergy)
+{
+  NS_LOG_UNCOND (Simulator::Now ().GetSeconds ()
+                 << "s Total energy consumed by node = " << totalEnergy << "J");
+}
+
+//****
+
+Gnuplot2dDataset
+Experiment::Run (const Scenario &scenario, const WifiHelper &wifi, const YansWifiPhyHelper &wifiPhy,
+                 const WifiMacHelper &wifiMac, const YansWifiChannelHelper &wifiChannel)
+{
+  std::chrono::steady_clock::time_point setupStart = std::chrono::steady_clock::now ();
+  m_bytesTotal = 0;
+  m_packetsTotal = 0;
+  m_sampledBytesTotal = 0;
+  m_samples.clear ();
+  if (!m_seriesFile.empty ())
+    {
+      m_series.Open (m_seriesFile, m_seriesBucket);
+    }
+  m_flowIds.clear ();
+  m_ipv4Owners.clear ();
+  m_sinkBytes.assign (scenario.nodes.size (), 0);
+  m_flowBytes.assign (scenario.flows.size (), 0);
+  m_flowDelays.assign (m_delayStats ? scenario.flows.size () : 0, DelayHistogram ());
+  m_flowJitter.assign (m_delayStats ? scenario.flows.size () : 0, DelayHistogram ());
+  m_lastDelays.assign (m_delayStats ? scenario.flows.size () : 0, 0);
+  m_lastUids.assign (m_delayStats ? scenario.flows.size () : 0, std::numeric_limits<uint64_t>::max ());
+  m_sampleTimes.clear ();
+  m_sinkSeries.clear ();
+  m_flowSeries.clear ();
+  m_convergence.Reset ();
+  m_stopReason = "traffic end";
+  m_stopTime = Seconds (0.0);
+  for (std::vector<ScenarioFlow>::const_iterator i = scenario.flows.begin (); i != scenario.flows.end (); ++i)
+    {
+      m_stopTime = std::max (m_stopTime, Seconds (i->stop));
+    }
+
+  // every helper installs node by node so that memory accounting can tell the nodes apart
+  m_firstNodeId = NodeList::GetNNodes ();
+  if (g_memoryAccounting)
+    {
+      ResetMemoryAccounting (m_firstNodeId);
+    }
+  NodeContainer c;
+  for (uint32_t i = 0; i < scenario.nodes.size (); i++)
+    {
+      MemoryScope scope (MEMORY_NODES, i);
+      c.Create (1);
+    }
+
+  PacketSocketHelper packetSocket;
+  for (uint32_t i = 0; i < c.GetN (); i++)
+    {
+      MemoryScope scope (MEMORY_PACKET_SOCKET, i);
+      packetSocket.Install (c.Get (i));
+    }
+
+  YansWifiPhyHelper phy = wifiPhy;
+  phy.SetChannel (wifiChannel.Create ());
+
+  WifiMacHelper mac = wifiMac;
+  NetDeviceContainer devices;
+  for (uint32_t i = 0; i < c.GetN (); i++)
+    {
+      MemoryScope scope (MEMORY_WIFI, i);
+      devices.Add (wifi.Install (phy, mac, c.Get (i)));
+    }
+
+  Ipv4InterfaceContainer interfaces;
+  if (m_routing == "olsr")
+    {
+      NS_LOG_INFO ("Enabling OLSR routing on all backbone nodes");
+      OlsrHelper olsr;
+      Ipv4StaticRoutingHelper staticRouting;
+      Ipv4ListRoutingHelper list;
+      list.Add (staticRouting, 0);
+      list.Add (olsr, 10);
+
+      InternetStackHelper internet;
+      internet.SetRoutingHelper (list);
+      Ipv4AddressHelper ipv4;
+      NS_LOG_INFO ("Assign IP Addresses.");
+      ipv4.SetBase ("10.1.0.0", "255.255.0.0");
+      for (uint32_t i = 0; i < c.GetN (); i++)
+        {
+          MemoryScope scope (MEMORY_INTERNET, i);
+          internet.Install (c.Get (i));
+        }
+      for (uint32_t i = 0; i < devices.GetN (); i++)
+        {
+          MemoryScope scope (MEMORY_INTERNET, i);
+          interfaces.Add (ipv4.Assign (NetDeviceContainer (devices.Get (i))));
+          m_ipv4Owners[interfaces.GetAddress (i)] = Mac48Address::ConvertFrom (devices.Get (i)->GetAddress ());
+        }
+    }
+
+  MobilityHelper mobility;
+  Ptr<ListPositionAllocator> positionAlloc = CreateObject<ListPositionAllocator> ();
+  for (std::vector<ScenarioNode>::const_iterator i = scenario.nodes.begin (); i != scenario.nodes.end (); ++i)
+    {
+      positionAlloc->Add (i->position);
+    }
+
+  mobility.SetPositionAllocator (positionAlloc);
+  mobility.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
+
+  for (uint32_t i = 0; i < c.GetN (); i++)
+    {
+      MemoryScope scope (MEMORY_MOBILITY, i);
+      mobility.Install (c.Get (i));
+    }
+
+ /** Energy Model **/
+  /***************************************************************************/
+  /* energy source */
+  BasicEnergySourceHelper basicSourceHelper;
+  // configure energy source
+  basicSourceHelper.Set ("BasicEnergySourceInitialEnergyJ", DoubleValue (scenario.initialEnergy));
+  // the lazy mode only updates on radio state changes and depletion checks
+  basicSourceHelper.Set ("PeriodicEnergyUpdateInterval",
+                         TimeValue (m_lazyEnergy ? m_stopTime + Seconds (1.0) : m_energyUpdateInterval));
+  // install source
+  EnergySourceContainer sources;
+  for (uint32_t i = 0; i < c.GetN (); i++)
+    {
+      MemoryScope scope (MEMORY_ENERGY, i);
+      sources.Add (basicSourceHelper.Install (c.Get (i)));
+    }
+  /* device energy model */
+  WifiRadioEnergyModelHelper radioEnergyHelper;
+  // configure radio energy model
+  radioEnergyHelper.Set ("TxCurrentA", DoubleValue (scenario.txCurrent));
+  // install device model
+  DeviceEnergyModelContainer deviceModels;
+  for (uint32_t i = 0; i < devices.GetN (); i++)
+    {
+      MemoryScope scope (MEMORY_ENERGY, i);
+      deviceModels.Add (radioEnergyHelper.Install (devices.Get (i), sources.Get (i)));
+    }
+  if (m_lazyEnergy)
+    {
+      m_lazyEnergyAccounting.Install (sources, devices, m_energyUpdateInterval);
+    }
+  m_energySources = EnergySourceContainer ();
+  m_finalEnergy.clear ();
+  m_depletionLevels.clear ();
+  m_depletionTimes.clear ();
+  if (m_energyReport)
+    {
+      m_energySources = sources;
+      m_depletionTimes.assign (sources.GetN (), -1.0);
+      for (uint32_t i = 0; i < sources.GetN (); i++)
+        {
+          DoubleValue threshold;
+          sources.Get (i)->GetAttribute ("BasicEnergyLowBatteryThreshold", threshold);
+          m_depletionLevels.push_back (threshold.Get () * sources.Get (i)->GetInitialEnergy ());
+          sources.Get (i)->TraceConnectWithoutContext ("RemainingEnergy",
+                                                       MakeBoundCallback (&Experiment::RecordDepletion, this, i));
+        }
+    }
+  /***************************************************************************/
+
+ 
+//****
+  OnOffHelper onoff ("ns3::PacketSocketFactory", Address ());
+  onoff.SetConstantRate (DataRate (6000));
+//data transfer start
+  std::set<uint16_t> protocols;
+  for (std::vector<ScenarioFlow>::const_iterator i = scenario.flows.begin (); i != scenario.flows.end (); ++i)
+    {
+      if (m_routing == "olsr")
+        {
+          NS_ABORT_MSG_IF (i->protocol > 65535 - UDP_PORT_BASE, "Flow protocol " << i->protocol << " has no UDP port");
+          onoff.SetAttribute ("Protocol", TypeIdValue (UdpSocketFactory::GetTypeId ()));
+          onoff.SetAttribute ("Remote", AddressValue (InetSocketAddress (interfaces.GetAddress (i->destination),
+                                                                         UDP_PORT_BASE + i->protocol)));
+          protocols.insert (i->protocol);
+        }
+      else
+        {
+          PacketSocketAddress socket;
+          socket.SetSingleDevice (devices.Get (i->source)->GetIfIndex ());
+          socket.SetPhysicalAddress (devices.Get (i->destination)->GetAddress ());
+          socket.SetProtocol (i->protocol);
+          onoff.SetAttribute ("Remote", AddressValue (socket));
+        }
+      onoff.SetAttribute ("DataRate", DataRateValue (DataRate (i->rate)));
+      onoff.SetAttribute ("PacketSize", UintegerValue (i->packetSize));
+      MemoryScope scope (MEMORY_APPLICATIONS, i->source);
+      ApplicationContainer apps = onoff.Install (c.Get (i->source));
+
+      apps.Start (Seconds (i->start));
+      apps.Stop (Seconds (i->stop));
+      if (m_delayStats)
+        {
+          apps.Get (0)->TraceConnectWithoutContext ("Tx", MakeCallback (&StampSendTime));
+        }
+      m_flowIds[std::make_tuple (Mac48Address::ConvertFrom (devices.Get (i->source)->GetAddress ()),
+                                 i->destination, i->protocol)] = i - scenario.flows.begin ();
+    }
+
+// (mobility)
+  m_mobility.Clear ();
+  for (uint32_t i = 0; i < scenario.nodes.size (); i++)
+    {
+      if (scenario.nodes[i].advanceStart >= 0.0)
+        {
+          MemoryScope scope (MEMORY_MOBILITY, i);
+          m_mobility.Add (c.Get (i), Seconds (scenario.nodes[i].advanceStart), Vector (1.0, 2.0, 0.0));
+        }
+    }
+  m_mobility.Start ();
+  std::vector<Ptr<Socket> > recvSinks;
+  recvSinks.reserve (scenario.sinks.size ());
+  m_sinkCopies.assign (scenario.nodes.size (), 0);
+  for (std::vector<uint32_t>::const_iterator i = scenario.sinks.begin (); i != scenario.sinks.end (); ++i)
+    {
+      MemoryScope scope (MEMORY_SINKS, *i);
+      if (m_routing == "olsr")
+        {
+          // a UDP port binds once per node
+          if (m_sinkCopies[*i]++ == 0)
+            {
+              for (std::set<uint16_t>::const_iterator j = protocols.begin (); j != protocols.end (); ++j)
+                {
+                  recvSinks.push_back (SetupDatagramReceive (c.Get (*i), *j));
+                }
+            }
+        }
+      else if (m_countingSinks)
+        {
+          c.Get (*i)->RegisterProtocolHandler (MakeCallback (&Experiment::CountPacket, this), 0, 0, false);
+        }
+      else
+        {
+          recvSinks.push_back (SetupPacketReceive (c.Get (*i)));
+        }
+    }
+  Simulator::Schedule (m_sampleInterval, &Experiment::Sample, this);
+  if (m_branch)
+    {
+      m_framesInFlight.assign (devices.GetN (), 0);
+      for (uint32_t i = 0; i < devices.GetN (); i++)
+        {
+          // the outcomes as the MAC itself sees them: an acknowledgement it
+          // no longer waits for is not one
+          Ptr<WifiMac> mac = DynamicCast<WifiNetDevice> (devices.Get (i))->GetMac ();
+          mac->TraceConnectWithoutContext ("MacTx", MakeBoundCallback (&Experiment::TrackFrameQueued, this, i));
+          mac->TraceConnectWithoutContext ("MacTxDrop", MakeBoundCallback (&Experiment::TrackFrameDropped, this, i));
+          mac->TraceConnectWithoutContext ("TxOkHeader", MakeBoundCallback (&Experiment::TrackFrameDone, this, i));
+          mac->TraceConnectWithoutContext ("TxErrHeader", MakeBoundCallback (&Experiment::TrackFrameDone, this, i));
+        }
+      Simulator::Schedule (m_branchAt, &Experiment::Branch, this, devices);
+    }
+
+
+
+/** connect trace sources **/
+  /***************************************************************************/
+  BinaryTraceSink traceSink;
+  if (!m_traceFile.empty ())
+    {
+      // every source and device model goes to the binary trace file
+      traceSink.Open (m_traceFile);
+      for (uint32_t i = 0; i < sources.GetN (); i++)
+        {
+          uint32_t node = c.Get (i)->GetId ();
+          Ptr<BasicEnergySource> source = DynamicCast<BasicEnergySource> (sources.Get (i));
+          source->TraceConnectWithoutContext ("RemainingEnergy",
+                                              MakeBoundCallback (&RecordRemainingEnergy, &traceSink, node));
+          DeviceEnergyModelContainer models = source->FindDeviceEnergyModels ("ns3::WifiRadioEnergyModel");
+          for (uint32_t j = 0; j < models.GetN (); j++)
+            {
+              models.Get (j)->TraceConnectWithoutContext ("TotalEnergyConsumption",
+                                                          MakeBoundCallback (&RecordTotalEnergy, &traceSink, node));
+            }
+        }
+    }
+  else
+    {
+      // all sources are connected to node 1
+      // energy source
+      NS_ABORT_MSG_IF (sources.GetN () < 2, "The energy traces need at least 2 nodes");
+      Ptr<BasicEnergySource> basicSourcePtr = DynamicCast<BasicEnergySource> (sources.Get (1));
+      basicSourcePtr->TraceConnectWithoutContext ("RemainingEnergy", MakeCallback (&RemainingEnergy));
+
+      // device energy model
+      Ptr<DeviceEnergyModel> basicRadioModelPtr = basicSourcePtr->FindDeviceEnergyModels ("ns3::WifiRadioEnergyModel").Get (0);
+      NS_ASSERT (basicRadioModelPtr != NULL);
+      basicRadioModelPtr->TraceConnectWithoutContext ("TotalEnergyConsumption", MakeCallback (&TotalEnergy));
+    }
+    
+/***************************************************************************/
+
+  if (m_livePage != 0)
+    {
+      // the energy of a node is as recent as its source's last update, reading it would force one
+      m_live.energy.assign (sources.GetN (), scenario.initialEnergy);
+      for (uint32_t i = 0; i < sources.GetN (); i++)
+        {
+          sources.Get (i)->TraceConnectWithoutContext ("RemainingEnergy",
+                                                       MakeBoundCallback (&RecordLiveEnergy, &m_live.energy, i));
+        }
+      m_live.events = 0;
+      m_livePublished = std::chrono::steady_clock::now ();
+      PublishMetrics (LIVE_RUNNING);
+      Simulator::Schedule (m_liveInterval, &Experiment::PublishPeriodically, this);
+    }
+
+  if (m_energyReport)
+    {
+      // before the stop event, which is scheduled next
+      Simulator::Schedule (m_stopTime, &Experiment::ReadFinalEnergy, this);
+    }
+  // the periodic energy source updates never run out of events
+  Simulator::Stop (m_stopTime);
+  std::chrono::steady_clock::time_point runStart = std::chrono::steady_clock::now ();
+  {
+    MemoryScope scope (MEMORY_SIMULATION, MEMORY_CONTEXT_NODE);
+    Simulator::Run ();
+  }
+  std::chrono::steady_clock::time_point runEnd = std::chrono::steady_clock::now ();
+  m_stoppedAt = Simulator::Now ();
+  m_runStats.setupSeconds = std::chrono::duration<double> (runStart - setupStart).count ();
+  m_runStats.runSeconds = std::chrono::duration<double> (runEnd - runStart).count ();
+  m_runStats.events = Simulator::GetEventCount ();
+  m_runStats.packets = m_packetsTotal;
+  if (m_livePage != 0)
+    {
+      PublishMetrics (LIVE_DONE);
+    }
+
+  if (g_memoryAccounting)
+    {
+      std::ostringstream report;
+      m_memoryPerNode = WriteMemoryReport (report, c, m_energySources);
+      if (!m_memoryReport.empty ())
+        {
+          std::ofstream out (m_memoryReport.c_str ());
+          NS_ABORT_MSG_IF (!out, "Cannot create " << m_memoryReport);
+          out << report.str ();
+        }
+    }
+
+  m_energySources = EnergySourceContainer ();
+  Simulator::Destroy ();
+
+  traceSink.Close ();
+  if (m_series.IsOpen ())
+    {
+      m_series.Close ();
+    }
+
+  return m_output;
+}
+
+/** Scenario loading **/
+/***************************************************************************/
+
+static ScenarioNode
+MakeScenarioNode (double x, double y, double advanceStart)
+{
+  ScenarioNode node;
+  node.position = Vector (x, y, 0.0);
+  node.advanceStart = advanceStart;
+  return node;
+}
+
+static ScenarioFlow
+MakeScenarioFlow (uint32_t source, uint32_t destination, double start)
+{
+  ScenarioFlow flow;
+  flow.source = source;
+  flow.destination = destination;
+  flow.protocol = 0;
+  flow.rate = 6000;
+  flow.packetSize = 200;
+  flow.start = start;
+  flow.stop = 250.0;
+  return flow;
+}
+
+/// The original 16 node scenario: nodes 1-15 send to node 0, nodes 6-15 move.
+static Scenario
+DefaultScenario (void)
+{
+  Scenario scenario;
+  scenario.nodes.push_back (MakeScenarioNode (100.0, 0.0, -1.0));   //node 0(mobile)
+  scenario.nodes.push_back (MakeScenarioNode (90.0, 10.0, -1.0));   //node1 e1
+  scenario.nodes.push_back (MakeScenarioNode (110.0, 10.0, -1.0));  //node2 e2
+  scenario.nodes.push_back (MakeScenarioNode (115.0, -10.0, -1.0)); //node3 e3
+  scenario.nodes.push_back (MakeScenarioNode (100.0, -10.0, -1.0)); //node4 e4
+  scenario.nodes.push_back (MakeScenarioNode (90.0, -10.0, -1.0));  //node5 e5
+  scenario.nodes.push_back (MakeScenarioNode (75.0, -35.0, 1.5));   //node6
+  scenario.nodes.push_back (MakeScenarioNode (95.0, -30.0, 0.6));   //node7
+  scenario.nodes.push_back (MakeScenarioNode (105.0, -25.0, 0.8));  //node8
+  scenario.nodes.push_back (MakeScenarioNode (85.0, -10.0, 0.9));   //node9
+  scenario.nodes.push_back (MakeScenarioNode (70.0, 0.0, 1.0));     //node10
+  scenario.nodes.push_back (MakeScenarioNode (55.0, -10.0, 2.0));   //node11
+  scenario.nodes.push_back (MakeScenarioNode (60.0, -20.0, 1.2));   //node12
+  scenario.nodes.push_back (MakeScenarioNode (110.0, -30.0, 1.4));  //node13
+  scenario.nodes.push_back (MakeScenarioNode (95.0, -40.0, 1.5));   //node14
+  scenario.nodes.push_back (MakeScenarioNode (85.0, -30.0, 1.0));   //node15
+
+  const double starts[] = { 0.5, 0.10, 0.15, 0.10, 0.5, 0.10, 0.15, 0.5,
+                            0.10, 0.15, 0.5, 0.10, 0.15, 0.5, 0.9 };
+  for (uint32_t i = 1; i < scenario.nodes.size (); i++)
+    {
+      scenario.flows.push_back (MakeScenarioFlow (i, 0, starts[i - 1]));
+    }
+  // one sink per moving node, all of them on node 1
+  scenario.sinks.assign (10, 1);
+
+  scenario.initialEnergy = 100.0;
+  scenario.txCurrent = 0.000001;
+  return scenario;
+}
+
+static void
+CheckScenario (const Scenario &scenario, std::string origin)
+{
+  uint32_t n = scenario.nodes.size ();
+  NS_ABORT_MSG_IF (n == 0, origin << ": scenario has no nodes");
+  // the run stops with the last flow
+  NS_ABORT_MSG_IF (scenario.flows.empty (), origin << ": scenario has no flows");
+  // the sinks tell flows apart by source, destination and protocol only
+  std::set<std::tuple<uint32_t, uint32_t, uint16_t> > flows;
+  for (std::vector<ScenarioFlow>::const_iterator i = scenario.flows.begin (); i != scenario.flows.end (); ++i)
+    {
+      NS_ABORT_MSG_IF (i->source >= n || i->destination >= n,
+                       origin << ": flow " << i->source << " -> " << i->destination
+                              << " refers to a node outside 0.." << n - 1);
+      NS_ABORT_MSG_IF (!flows.insert (std::make_tuple (i->source, i->destination, i->protocol)).second,
+                       origin << ": two flows " << i->source << " -> " << i->destination
+                              << " with protocol " << i->protocol);
+    }
+  for (std::vector<uint32_t>::const_iterator i = scenario.sinks.begin (); i != scenario.sinks.end (); ++i)
+    {
+      NS_ABORT_MSG_IF (*i >= n, origin << ": sink on unknown node " << *i);
+    }
+}
+
+/**
+ * Parses field fieldIndex of a scenario record as a number within
+ * [min, max], an integer if integer is true.  Blanks around the number are
+ * allowed, anything else aborts.
+ */
+static double
+ParseScenarioField (const std::vector<std::string> &fields, uint32_t fieldIndex, double min, double max,
+                    bool integer, std::string origin)
+{
+  const std::string &field = fields[fieldIndex];
+  const char *begin = field.c_str ();
+  char *end;
+  double value = std::strtod (begin, &end);
+  while (*end == ' ' || *end == '\t' || *end == '\r')
+    {
+      end++;
+    }
+  NS_ABORT_MSG_IF (end == begin || *end != '\0' || !std::isfinite (value),
+                   origin << ": '" << field << "' is not a number");
+  NS_ABORT_MSG_IF (integer && value != std::floor (value),
+                   origin << ": " << fields[0] << " field " << fieldIndex << " '" << field << "' is not an integer");
+  NS_ABORT_MSG_IF (value < min || value > max,
+                   origin << ": " << fields[0] << " field " << fieldIndex << " " << value
+                          << " is outside " << min << ".." << max);
+  return value;
+}
+
+/**
+ * Adds a scenario record given as its kind followed by its values, in the
+ * order of the CSV records of LoadScenario.  Values out of range abort with
+ * origin; returns false if the kind is unknown or the count is wrong.
+ */
+static bool
+AddScenarioRecord (Scenario &scenario, const std::vector<std::string> &fields, std::string origin)
+{
+  const double inf = std::numeric_limits<double>::infinity ();
+  const double maxIndex = std::numeric_limits<uint32_t>::max ();
+  if (fields[0] == "node" && (fields.size () == 4 || fields.size () == 5))
+    {
+      ScenarioNode node;
+      node.position = Vector (ParseScenarioField (fields, 1, -inf, inf, false, origin),
+                              ParseScenarioField (fields, 2, -inf, inf, false, origin),
+                              ParseScenarioField (fields, 3, -inf, inf, false, origin));
+      node.advanceStart = fields.size () == 5 ? ParseScenarioField (fields, 4, -inf, inf, false, origin) : -1.0;
+      scenario.nodes.push_back (node);
+    }
+  else if (fields[0] == "flow" && fields.size () == 8)
+    {
+      ScenarioFlow flow;
+      flow.source = ParseScenarioField (fields, 1, 0, maxIndex, true, origin);
+      flow.destination = ParseScenarioField (fields, 2, 0, maxIndex, true, origin);
+      flow.protocol = ParseScenarioField (fields, 3, 0, std::numeric_limits<uint16_t>::max (), true, origin);
+      flow.rate = ParseScenarioField (fields, 4, 1, 1e15, true, origin);
+      flow.packetSize = ParseScenarioField (fields, 5, 1, maxIndex, true, origin);
+      flow.start = ParseScenarioField (fields, 6, 0, inf, false, origin);
+      flow.stop = ParseScenarioField (fields, 7, 0, inf, false, origin);
+      NS_ABORT_MSG_IF (flow.stop <= flow.start, origin << ": flow stops before it starts");
+      scenario.flows.push_back (flow);
+    }
+  else if (fields[0] == "sink" && fields.size () == 2)
+    {
+      scenario.sinks.push_back (ParseScenarioField (fields, 1, 0, maxIndex, true, origin));
+    }
+  else if (fields[0] == "energy" && fields.size () == 3)
+    {
+      scenario.initialEnergy = ParseScenarioField (fields, 1, 0, inf, false, origin);
+      scenario.txCurrent = ParseScenarioField (fields, 2, 0, inf, false, origin);
+      NS_ABORT_MSG_IF (scenario.initialEnergy == 0, origin << ": initial energy must be positive");
+    }
+  else
+    {
+      return false;
+    }
+  return true;
+}
+
+/**
+ * Reader of JSON scenarios.  Every node, flow, sink and energy entry is
+ * turned into the fields of the matching CSV record and added by
+ * AddScenarioRecord, so both formats accept the same values.  Only the
+ * JSON needed by the format is understood: objects, arrays, numbers and
+ * strings without escapes.
+ */
+class ScenarioJsonReader
+{
+public:
+  ScenarioJsonReader (std::string path, const std::string &text);
+  Scenario Read (void);
+private:
+  void SkipBlanks (void);
+  /// Skips blanks and consumes c if it comes next.
+  bool Accept (char c);
+  void Expect (char c);
+  std::string ReadString (void);
+  /// The text of a number, checked by ParseScenarioField.
+  std::string ReadNumber (void);
+  /**
+   * Reads an object mapping the names in keys to numbers into the fields of
+   * a kind record, in the order of keys.  The keys from required on may be
+   * left out, from the last one backwards.
+   */
+  std::vector<std::string> ReadRecord (std::string kind, const std::vector<std::string> &keys, uint32_t required);
+  /// <path>:<line> of the current position.
+  std::string GetOrigin (void) const;
+
+  std::string m_path;
+  const std::string &m_text;
+  size_t m_position;
+  uint32_t m_line;
+};
+
+ScenarioJsonReader::ScenarioJsonReader (std::string path, const std::string &text)
+  : m_path (path),
+    m_text (text),
+    m_position (0),
+    m_line (1)
+{
+}
+
+std::string
+ScenarioJsonReader::GetOrigin (void) const
+{
+  std::ostringstream origin;
+  origin << m_path << ":" << m_line;
+  return origin.str ();
+}
+
+void
+ScenarioJsonReader::SkipBlanks (void)
+{
+  while (m_position < m_text.size () && std::isspace (static_cast<unsigned char> (m_text[m_position])))
+    {
+      m_line += m_text[m_position++] == '\n';
+    }
+}
+
+bool
+ScenarioJsonReader::Accept (char c)
+{
+  SkipBlanks ();
+  if (m_position < m_text.size () && m_text[m_position] == c)
+    {
+      m_position++;
+      return true;
+    }
+  return false;
+}
+
+void
+ScenarioJsonReader::Expect (char c)
+{
+  NS_ABORT_MSG_IF (!Accept (c), GetOrigin () << ": expected '" << c << "'");
+}
+
+std::string
+ScenarioJsonReader::ReadString (void)
+{
+  Expect ('"');
+  size_t end = m_text.find_first_of ("\"\\\n", m_position);
+  NS_ABORT_MSG_IF (end == std::string::npos || m_text[end] != '"', GetOrigin () << ": unterminated string");
+  std::string value = m_text.substr (m_position, end - m_position);
+  m_position = end + 1;
+  return value;
+}
+
+std::string
+ScenarioJsonReader::ReadNumber (void)
+{
+  SkipBlanks ();
+  size_t end = m_text.find_first_not_of ("+-.0123456789eE", m_position);
+  if (end == std::string::npos)
+    {
+      end = m_text.size ();
+    }
+  NS_ABORT_MSG_IF (end == m_position, GetOrigin () << ": expected a number");
+  std::string value = m_text.substr (m_position, end - m_position);
+  m_position = end;
+  return value;
+}
+
+std::vector<std::string>
+ScenarioJsonReader::ReadRecord (std::string kind, const std::vector<std::string> &keys, uint32_t required)
+{
+  std::vector<std::string> values (keys.size ());
+  std::vector<bool> seen (keys.size (), false);
+  Expect ('{');
+  if (!Accept ('}'))
+    {
+      do
+        {
+          std::string key = ReadString ();
+          uint32_t k = std::find (keys.begin (), keys.end (), key) - keys.begin ();
+          NS_ABORT_MSG_IF (k == keys.size (), GetOrigin () << ": unknown " << kind << " key \"" << key << "\"");
+          NS_ABORT_MSG_IF (seen[k], GetOrigin () << ": " << kind << " key \"" << key << "\" given twice");
+          Expect (':');
+          values[k] = ReadNumber ();
+          seen[k] = true;
+        }
+      while (Accept (','));
+      Expect ('}');
+    }
+  std::vector<std::string> fields (1, kind);
+  for (uint32_t k = 0; k < keys.size (); k++)
+    {
+      if (!seen[k])
+        {
+          NS_ABORT_MSG_IF (k < required || std::count (seen.begin () + k, seen.end (), true) != 0,
+                           GetOrigin () << ": " << kind << " without \"" << keys[k] << "\"");
+          break;
+        }
+      fields.push_back (values[k]);
+    }
+  return fields;
+}
+
+/**
+ * Reads an object with the optional members
+ *
+ *   "nodes": [{"x": <x>, "y": <y>, "z": <z>[, "advanceStart": <s>]}, ...]
+ *   "flows": [{"source": <node>, "destination": <node>, "protocol": <p>, "rate": <bit/s>,
+ *              "packetSize": <bytes>, "start": <s>, "stop": <s>}, ...]
+ *   "sinks": [<node>, ...]
+ *   "energy": {"initialEnergy": <J>, "txCurrent": <A>}
+ */
+Scenario
+ScenarioJsonReader::Read (void)
+{
+  static const char *nodeKeys[] = { "x", "y", "z", "advanceStart" };
+  static const char *flowKeys[] = { "source", "destination", "protocol", "rate", "packetSize", "start", "stop" };
+  static const char *energyKeys[] = { "initialEnergy", "txCurrent" };
+  Scenario scenario;
+  scenario.initialEnergy = 100.0;
+  scenario.txCurrent = 0.000001;
+  std::set<std::string> members;
+  Expect ('{');
+  if (!Accept ('}'))
+    {
+      do
+        {
+          std::string member = ReadString ();
+          NS_ABORT_MSG_IF (!members.insert (member).second, GetOrigin () << ": \"" << member << "\" given twice");
+          Expect (':');
+          if (member == "energy")
+            {
+              SkipBlanks ();
+              std::string origin = GetOrigin ();
+              AddScenarioRecord (scenario, ReadRecord ("energy", std::vector<std::string> (energyKeys, energyKeys + 2),
+                                                       2), origin);
+              continue;
+            }
+          NS_ABORT_MSG_IF (member != "nodes" && member != "flows" && member != "sinks",
+                           GetOrigin () << ": unknown member \"" << member << "\"");
+          Expect ('[');
+          if (Accept (']'))
+            {
+              continue;
+            }
+          do
+            {
+              SkipBlanks ();
+              std::string origin = GetOrigin ();
+              std::vector<std::string> fields;
+              if (member == "nodes")
+                {
+                  fields = ReadRecord ("node", std::vector<std::string> (nodeKeys, nodeKeys + 4), 3);
+                }
+              else if (member == "flows")
+                {
+                  fields = ReadRecord ("flow", std::vector<std::string> (flowKeys, flowKeys + 7), 7);
+                }
+              else
+                {
+                  fields.push_back ("sink");
+                  fields.push_back (ReadNumber ());
+                }
+              AddScenarioRecord (scenario, fields, origin);
+            }
+          while (Accept (','));
+          Expect (']');
+        }
+      while (Accept (','));
+      Expect ('}');
+    }
+  SkipBlanks ();
+  NS_ABORT_MSG_IF (m_position != m_text.size (), GetOrigin () << ": unexpected text after the scenario");
+  return scenario;
+}
+
+/**
+ * Reads a scenario from a JSON file, see ScenarioJsonReader::Read, or from
+ * a CSV file with one record per line:
+ *
+ *   node,<x>,<y>,<z>[,<advanceStart>]
+ *   flow,<source>,<destination>,<protocol>,<rate bit/s>,<packet size>,<start>,<stop>
+ *   sink,<node>
+ *   energy,<initial energy J>,<tx current A>
+ *
+ * A file whose first non-blank character is '{' is JSON.  In CSV, empty
+ * lines and lines starting with '#' are ignored.  Nodes are numbered in
+ * the order they are given.  Energy parameters default to the ones of
+ * DefaultScenario.  Counts, indices and sizes must be non-negative
+ * integers, a flow must stop after it starts, no two flows may share their
+ * source, destination and protocol, and a scenario needs at least one node
+ * and one flow; anything else aborts.
+ */
+static Scenario
+LoadScenario (std::string path)
+{
+  std::ifstream in (path.c_str ());
+  NS_ABORT_MSG_IF (!in, "Cannot open scenario file " << path);
+  std::string text ((std::istreambuf_iterator<char> (in)), std::istreambuf_iterator<char> ());
+  size_t first = text.find_first_not_of (" \t\r\n");
+  if (first != std::string::npos && text[first] == '{')
+    {
+      Scenario scenario = ScenarioJsonReader (path, text).Read ();
+      CheckScenario (scenario, path);
+      return scenario;
+    }
+
+  Scenario scenario;
+  scenario.initialEnergy = 100.0;
+  scenario.txCurrent = 0.000001;
+  std::istringstream lines (text);
+  std::string line;
+  uint32_t lineNumber = 0;
+  while (std::getline (lines, line))
+    {
+      lineNumber++;
+      if (line.empty () || line[0] == '#')
+        {
+          continue;
+        }
+      std::vector<std::string> fields;
+      std::istringstream record (line);
+      std::string field;
+      while (std::getline (record, field, ','))
+        {
+          fields.push_back (field);
+        }
+      std::ostringstream origin;
+      origin << path << ":" << lineNumber;
+      // a trailing comma leaves no empty last field to getline
+      NS_ABORT_MSG_IF (line[line.size () - 1] == ',' || !AddScenarioRecord (scenario, fields, origin.str ()),
+                       origin.str () << ": malformed record '" << line << "'");
+    }
+  CheckScenario (scenario, path);
+  return scenario;
+}
+
+/**
+ * Builds a scenario of nodes placed on a square grid or uniformly at random
+ * over the same area, spacing meters apart on average.  Flow i goes from node
+ * s = 1 + i * (nodes - 1) / flows to its predecessor s - 1, which has a sink;
+ * the last mobile nodes move with staggered first steps.
+ */
+static Scenario
+GenerateScenario (std::string layout, uint32_t nodes, uint32_t flows, uint32_t mobile,
+                  double spacing, uint32_t seed)
+{
+  NS_ABORT_MSG_IF (nodes < 2, "A generated scenario needs at least 2 nodes");
+  NS_ABORT_MSG_IF (flows == 0, "A generated scenario needs at least 1 flow");
+  NS_ABORT_MSG_IF (layout != "grid" && layout != "random", "Unknown layout " << layout);
+  Scenario scenario;
+  uint32_t width = std::ceil (std::sqrt (static_cast<double> (nodes)));
+  std::mt19937 rng (seed);
+  std::uniform_real_distribution<double> coordinate (0.0, width * spacing);
+  scenario.nodes.reserve (nodes);
+  for (uint32_t i = 0; i < nodes; i++)
+    {
+      double advanceStart = i >= nodes - std::min (mobile, nodes) ? 0.5 + 0.15 * (i % 10) : -1.0;
+      if (layout == "grid")
+        {
+          scenario.nodes.push_back (MakeScenarioNode ((i % width) * spacing, (i / width) * spacing,
+                                                      advanceStart));
+        }
+      else
+        {
+          double x = coordinate (rng);
+          double y = coordinate (rng);
+          scenario.nodes.push_back (MakeScenarioNode (x, y, advanceStart));
+        }
+    }
+  flows = std::min (flows, nodes - 1);
+  scenario.flows.reserve (flows);
+  scenario.sinks.reserve (flows);
+  for (uint32_t i = 0; i < flows; i++)
+    {
+      uint32_t source = 1 + static_cast<uint64_t> (i) * (nodes - 1) / flows;
+      scenario.flows.push_back (MakeScenarioFlow (source, source - 1, 0.1 + 0.01 * (i % 100)));
+      scenario.sinks.push_back (source - 1);
+    }
+  scenario.initialEnergy = 100.0;
+  scenario.txCurrent = 0.000001;
+  return scenario;
+}
+
+/***************************************************************************/
+
+/** Sweep **/
+/***************************************************************************/
+
+/// Settings shared by every configuration of a sweep.
+struct ExperimentOptions
+{
+  std::string channel;        ///< "yans" or "cached"
+  std::string tracePrefix;    ///< binary energy traces go to <tracePrefix><name>.trace if not empty
+  double sampleInterval;      ///< seconds between throughput samples
+  std::string profilePrefix;  ///< event profiles go to <profilePrefix><name>.folded if not empty
+  std::string seriesPrefix;   ///< throughput samples stream to <seriesPrefix><name>.dat if not empty
+  uint32_t seriesBucket;      ///< samples per min/max bucket of the series files, 1 keeps every sample
+  bool converge;              ///< stop every run once its throughput has converged
+  bool lazyEnergy;            ///< integrate energy on radio state changes only
+  bool countingSinks;         ///< count sink traffic in protocol handlers instead of packet sockets
+  std::string routing;        ///< "none" for one hop packet sockets, "olsr" for UDP over OLSR
+  std::string memoryPrefix;   ///< per node memory reports go to <memoryPrefix><name>.csv if not empty
+  bool tabulatedErrors;       ///< read chunk success rates from TabulatedErrorRateModel tables
+  ConvergenceController convergence;
+  std::string flowStatsPrefix; ///< per-sink and per-flow counters go to <flowStatsPrefix><name>.csv if not empty
+  LiveMetricsPage *metrics;   ///< page the runs publish their live counters to, 0 for none
+  double metricsInterval;     ///< simulated seconds between two publications
+  double branchAt;            ///< seconds of warm-up shared by the configurations of a standard, 0 for none
+  bool delayStats;            ///< measure the delay and jitter of every flow
+  bool energyReport;          ///< record the final energy and depletion time of every node
+};
+
+/// The options of a sweep without command line arguments.
+static ExperimentOptions
+DefaultExperimentOptions (void)
+{
+  ExperimentOptions options;
+  options.channel = "yans";
+  options.sampleInterval = 1.5;
+  options.seriesBucket = 1;
+  options.converge = false;
+  options.lazyEnergy = false;
+  options.countingSinks = false;
+  options.routing = "none";
+  options.tabulatedErrors = false;
+  options.metrics = 0;
+  options.metricsInterval = 0.1;
+  options.branchAt = 0.0;
+  options.delayStats = false;
+  options.energyReport = false;
+  return options;
+}
+
+/// The channel helper selected by the options.
+static YansWifiChannelHelper
+MakeChannelHelper (const ExperimentOptions &options)
+{
+  if (options.channel == "cached")
+    {
+      YansWifiChannelHelper wifiChannel;
+      wifiChannel.SetPropagationDelay ("ns3::ConstantSpeedPropagationDelayModel");
+      wifiChannel.AddPropagationLoss ("ns3::CachedLogDistancePropagationLossModel");
+      return wifiChannel;
+    }
+  NS_ABORT_MSG_IF (options.channel != "yans", "Unknown channel " << options.channel);
+  return YansWifiChannelHelper::Default ();
+}
+
+/// The PHY helper selected by the options.
+static YansWifiPhyHelper
+MakePhyHelper (const ExperimentOptions &options)
+{
+  YansWifiPhyHelper wifiPhy = YansWifiPhyHelper::Default ();
+  if (options.tabulatedErrors)
+    {
+      wifiPhy.SetErrorRateModel ("ns3::TabulatedErrorRateModel");
+    }
+  return wifiPhy;
+}
+
+/// One point of the sweep: a station manager configuration and the plot it belongs to.
+struct SweepConfig
+{
+  std::string name;           ///< dataset title
+  std::string plot;           ///< gnuplot output file the dataset is added to
+  WifiPhyStandard standard;
+  std::string manager;        ///< WifiRemoteStationManager TypeId name
+  std::string dataMode;       ///< DataMode of a constant rate manager, empty otherwise
+};
+
+static SweepConfig
+MakeSweepConfig (std::string name, std::string plot, WifiPhyStandard standard,
+                 std::string manager, std::string dataMode)
+{
+  SweepConfig config;
+  config.name = name;
+  config.plot = plot;
+  config.standard = standard;
+  config.manager = manager;
+  config.dataMode = dataMode;
+  return config;
+}
+
+/// The 8 reference rates followed by the 6 rate control algorithms, in plot order.
+static std::vector<SweepConfig>
+DefaultSweep (void)
+{
+  std::vector<SweepConfig> sweep;
+  const char *rates[] = { "54", "48", "36", "24", "18", "12", "9", "6" };
+  for (uint32_t i = 0; i < sizeof (rates) / sizeof (rates[0]); i++)
+    {
+      sweep.push_back (MakeSweepConfig (std::string (rates[i]) + "mb", "reference-rates.png",
+                                        WIFI_PHY_STANDARD_80211a, "ns3::ConstantRateWifiManager",
+                                        std::string ("OfdmRate") + rates[i] + "Mbps"));
+    }
+  sweep.push_back (MakeSweepConfig ("arf", "rate-control.png", WIFI_PHY_STANDARD_holland,
+                                    "ns3::ArfWifiManager", ""));
+  sweep.push_back (MakeSweepConfig ("aarf", "rate-control.png", WIFI_PHY_STANDARD_holland,
+                                    "ns3::AarfWifiManager", ""));
+  sweep.push_back (MakeSweepConfig ("aarf-cd", "rate-control.png", WIFI_PHY_STANDARD_holland,
+                                    "ns3::AarfcdWifiManager", ""));
+  sweep.push_back (MakeSweepConfig ("cara", "rate-control.png", WIFI_PHY_STANDARD_holland,
+                                    "ns3::CaraWifiManager", ""));
+  sweep.push_back (MakeSweepConfig ("rraa", "rate-control.png", WIFI_PHY_STANDARD_holland,
+                                    "ns3::RraaWifiManager", ""));
+  sweep.push_back (MakeSweepConfig ("ideal", "rate-control.png", WIFI_PHY_STANDARD_holland,
+                                    "ns3::IdealWifiManager", ""));
+  return sweep;
+}
+
+/// Index of the configuration called name in the sweep; aborts if there is none.
+static uint32_t
+FindSweepConfig (const std::vector<SweepConfig> &sweep, std::string name)
+{
+  for (uint32_t i = 0; i < sweep.size (); i++)
+    {
+      if (sweep[i].name == name)
+        {
+          return i;
+        }
+    }
+  NS_FATAL_ERROR ("Unknown sweep configuration " << name);
+  return 0;
+}
+
+/// The wifi helper of a sweep configuration.
+static WifiHelper
+MakeWifiHelper (const SweepConfig &config)
+{
+  WifiHelper wifi;
+  wifi.SetStandard (config.standard);
+  if (config.dataMode.empty ())
+    {
+      wifi.SetRemoteStationManager (config.manager);
+    }
+  else
+    {
+      wifi.SetRemoteStationManager (config.manager,
+                                    "DataMode", StringValue (config.dataMode));
+    }
+  return wifi;
+}
+
+/// What a sweep configuration produced.
+struct SweepResult
+{
+  Experiment::Samples samples;  ///< empty when the samples went to seriesFile
+  std::string seriesFile;
+  double stopTime;            ///< seconds
+  std::string stopReason;
+  double memoryPerNode;       ///< bytes, 0 without memory accounting
+  std::vector<DelayHistogram> delays;   ///< per flow, empty without delay stats
+  std::vector<DelayHistogram> jitter;   ///< per flow, empty without delay stats
+  std::vector<double> finalEnergy;      ///< J per node, empty without an energy report
+  std::vector<double> depletionTimes;   ///< seconds per node, -1 if never drained, empty without an energy report
+};
+
+/// Applies the options to the experiment of a configuration; returns its series file, if any.
+static std::string
+ConfigureExperiment (Experiment &experiment, const ExperimentOptions &options, const SweepConfig &config)
+{
+  if (!options.tracePrefix.empty ())
+    {
+      experiment.SetTraceFile (options.tracePrefix + config.name + ".trace");
+    }
+  experiment.SetSampleInterval (Seconds (options.sampleInterval));
+  experiment.SetFlowStats (!options.flowStatsPrefix.empty ());
+  if (options.converge)
+    {
+      experiment.EnableConvergenceControl (options.convergence);
+    }
+  experiment.SetLazyEnergy (options.lazyEnergy);
+  experiment.SetCountingSinks (options.countingSinks);
+  experiment.SetRouting (options.routing);
+  experiment.SetDelayStats (options.delayStats);
+  experiment.SetEnergyReport (options.energyReport);
+  if (!options.memoryPrefix.empty ())
+    {
+      experiment.SetMemoryReport (options.memoryPrefix + config.name + ".csv");
+    }
+  if (options.metrics != 0)
+    {
+      experiment.SetLiveMetrics (options.metrics, options.metrics->FindSlot (config.name),
+                                 Seconds (options.metricsInterval));
+    }
+  std::string seriesFile;
+  if (!options.seriesPrefix.empty ())
+    {
+      seriesFile = options.seriesPrefix + config.name + ".dat";
+      experiment.SetSeriesFile (seriesFile, options.seriesBucket);
+    }
+  return seriesFile;
+}
+
+/// Writes the side files of a configuration whose experiment has run and returns its result.
+static SweepResult
+FinishExperiment (const Experiment &experiment, const ExperimentOptions &options, const SweepConfig &config,
+                  std::string seriesFile)
+{
+  if (!options.flowStatsPrefix.empty ())
+    {
+      experiment.WriteFlowStats (options.flowStatsPrefix + config.name + ".csv");
+    }
+  SweepResult result;
+  result.samples = experiment.GetSamples ();
+  result.seriesFile = seriesFile;
+  result.stopTime = experiment.GetStopTime ().GetSeconds ();
+  result.stopReason = experiment.GetStopReason ();
+  result.memoryPerNode = experiment.GetMemoryPerNode ();
+  result.delays = experiment.GetFlowDelays ();
+  result.jitter = experiment.GetFlowJitter ();
+  result.finalEnergy = experiment.GetFinalEnergy ();
+  result.depletionTimes = experiment.GetDepletionTimes ();
+  return result;
+}
+
+/// Runs a single sweep configuration in this process.
+static SweepResult
+RunSweepConfig (const Scenario &scenario, const ExperimentOptions &options, const SweepConfig &config)
+{
+  NS_LOG_DEBUG (config.name);
+  WifiHelper wifi = MakeWifiHelper (config);
+  WifiMacHelper wifiMac;
+  wifiMac.SetType ("ns3::AdhocWifiMac");
+  YansWifiPhyHelper wifiPhy = MakePhyHelper (options);
+  YansWifiChannelHelper wifiChannel = MakeChannelHelper (options);
+
+  if (!options.profilePrefix.empty ())
+    {
+      Config::SetDefault ("ns3::ProfilingSimulatorImpl::FlameGraphFile",
+                          StringValue (options.profilePrefix + config.name + ".folded"));
+    }
+  Experiment experiment (config.name);
+  std::string seriesFile = ConfigureExperiment (experiment, options, config);
+  experiment.Run (scenario, wifi, wifiPhy, wifiMac, wifiChannel);
+  return FinishExperiment (experiment, options, config, seriesFile);
+}
+
+/**
+ * Replaces the remote station manager of every wifi device with a new one
+ * of the configuration.  The device only wires a manager to its MAC and PHY
+ * while it is being configured, so this does it for a running device.  The
+ * MAC reports the outcome of a frame to the manager of the moment, so call
+ * it with no frame in flight, as Experiment::SetBranchPoint does.  The new
+ * managers know no station yet, as at the start of a run; the MAC sets a
+ * station up again with the first frame to or from it.
+ */
+static void
+SwapStationManagers (NetDeviceContainer devices, const SweepConfig &config)
+{
+  ObjectFactory factory;
+  factory.SetTypeId (config.manager);
+  if (!config.dataMode.empty ())
+    {
+      factory.Set ("DataMode", StringValue (config.dataMode));
+    }
+  for (uint32_t i = 0; i < devices.GetN (); i++)
+    {
+      Ptr<WifiNetDevice> device = DynamicCast<WifiNetDevice> (devices.Get (i));
+      Ptr<WifiRemoteStationManager> manager = factory.Create<WifiRemoteStationManager> ();
+      device->SetRemoteStationManager (manager);
+      manager->SetupPhy (device->GetPhy ());
+      manager->SetupMac (device->GetMac ());
+      device->GetMac ()->SetWifiRemoteStationManager (manager);
+    }
+}
+
+/// Appends the bytes of a trivially copyable value to a worker result.
+template <typename T>
+static void
+AppendValue (std::string &buffer, T value)
+{
+  buffer.append (reinterpret_cast<const char *> (&value), sizeof (value));
+}
+
+/// Reads a value written by AppendValue at offset and moves offset past it.
+template <typename T>
+static T
+ReadValue (const std::string &buffer, size_t &offset)
+{
+  T value;
+  NS_ABORT_MSG_IF (offset + sizeof (value) > buffer.size (), "Truncated worker result");
+  std::memcpy (&value, buffer.data () + offset, sizeof (value));
+  offset += sizeof (value);
+  return value;
+}
+
+static void
+AppendString (std::string &buffer, const std::string &value)
+{
+  AppendValue<uint64_t> (buffer, value.size ());
+  buffer.append (value);
+}
+
+static std::string
+ReadString (const std::string &buffer, size_t &offset)
+{
+  uint64_t n = ReadValue<uint64_t> (buffer, offset);
+  NS_ABORT_MSG_IF (offset + n > buffer.size (), "Truncated worker result");
+  std::string value = buffer.substr (offset, n);
+  offset += n;
+  return value;
+}
+
+/// Appends the histogram to a worker result, writing only the buckets in use.
+void
+DelayHistogram::Encode (std::string &buffer) const
+{
+  AppendValue (buffer, m_count);
+  if (m_count == 0)
+    {
+      return;
+    }
+  AppendValue (buffer, m_min);
+  AppendValue (buffer, m_max);
+  AppendValue (buffer, m_sum);
+  uint32_t used = BUCKETS - std::count (m_counts.begin (), m_counts.end (), 0);
+  AppendValue (buffer, used);
+  for (uint32_t i = 0; i < BUCKETS; i++)
+    {
+      if (m_counts[i] != 0)
+        {
+          AppendValue<uint16_t> (buffer, i);
+          AppendValue (buffer, m_counts[i]);
+        }
+    }
+}
+
+void
+DelayHistogram::Decode (const std::string &buffer, size_t &offset)
+{
+  *this = DelayHistogram ();
+  m_count = ReadValue<uint64_t> (buffer, offset);
+  if (m_count == 0)
+    {
+      return;
+    }
+  m_min = ReadValue<uint64_t> (buffer, offset);
+  m_max = ReadValue<uint64_t> (buffer, offset);
+  m_sum = ReadValue<double> (buffer, offset);
+  m_counts.assign (BUCKETS, 0);
+  uint32_t used = ReadValue<uint32_t> (buffer, offset);
+  for (uint32_t i = 0; i < used; i++)
+    {
+      uint16_t bucket = ReadValue<uint16_t> (buffer, offset);
+      NS_ABORT_MSG_IF (bucket >= BUCKETS, "Corrupt delay histogram");
+      m_counts[bucket] = ReadValue<uint32_t> (buffer, offset);
+    }
+}
+
+static std::string
+EncodeResult (const SweepResult &result)
+{
+  std::string buffer;
+  AppendValue<uint64_t> (buffer, result.samples.size ());
+  for (Experiment::Samples::const_iterator i = result.samples.begin (); i != result.samples.end (); ++i)
+    {
+      AppendValue (buffer, i->first);
+      AppendValue (buffer, i->second);
+    }
+  AppendString (buffer, result.seriesFile);
+  AppendValue (buffer, result.stopTime);
+  AppendString (buffer, result.stopReason);
+  AppendValue (buffer, result.memoryPerNode);
+  AppendValue<uint64_t> (buffer, result.delays.size ());
+  for (uint32_t i = 0; i < result.delays.size (); i++)
+    {
+      result.delays[i].Encode (buffer);
+      result.jitter[i].Encode (buffer);
+    }
+  AppendValue<uint64_t> (buffer, result.finalEnergy.size ());
+  for (uint32_t i = 0; i < result.finalEnergy.size (); i++)
+    {
+      AppendValue (buffer, result.finalEnergy[i]);
+      AppendValue (buffer, result.depletionTimes[i]);
+    }
+  return buffer;
+}
+
+static SweepResult
+DecodeResult (const std::string &buffer)
+{
+  SweepResult result;
+  size_t offset = 0;
+  uint64_t n = ReadValue<uint64_t> (buffer, offset);
+  result.samples.reserve (n);
+  for (uint64_t i = 0; i < n; i++)
+    {
+      double x = ReadValue<double> (buffer, offset);
+      double y = ReadValue<double> (buffer, offset);
+      result.samples.push_back (std::make_pair (x, y));
+    }
+  result.seriesFile = ReadString (buffer, offset);
+  result.stopTime = ReadValue<double> (buffer, offset);
+  result.stopReason = ReadString (buffer, offset);
+  result.memoryPerNode = ReadValue<double> (buffer, offset);
+  result.delays.resize (ReadValue<uint64_t> (buffer, offset));
+  result.jitter.resize (result.delays.size ());
+  for (uint32_t i = 0; i < result.delays.size (); i++)
+    {
+      result.delays[i].Decode (buffer, offset);
+      result.jitter[i].Decode (buffer, offset);
+    }
+  result.finalEnergy.resize (ReadValue<uint64_t> (buffer, offset));
+  result.depletionTimes.resize (result.finalEnergy.size ());
+  for (uint32_t i = 0; i < result.finalEnergy.size (); i++)
+    {
+      result.finalEnergy[i] = ReadValue<double> (buffer, offset);
+      result.depletionTimes[i] = ReadValue<double> (buffer, offset);
+    }
+  NS_ABORT_MSG_IF (offset != buffer.size (), "Worker result has " << buffer.size () - offset << " extra bytes");
+  return result;
+}
 
-ApplicationContainer apps18 = onoff.Install (c.Get (19));
+static void
+WriteAll (int fd, const std::string &buffer)
+{
+  size_t done = 0;
+  while (done < buffer.size ())
+    {
+      ssize_t n = write (fd, buffer.data () + done, buffer.size () - done);
+      if (n < 0 && errno == EINTR)
+        {
+          continue;
+        }
+      NS_ABORT_MSG_IF (n < 0, "write to parent failed: " << std::strerror (errno));
+      done += n;
+    }
+}
 
-  apps18.Start (Seconds (0.15));
-  apps18.Stop (Seconds (250.0));*/
+/// A forked worker process writing its result to a pipe.
+struct Worker
+{
+  pid_t pid;
+  int fd;                     ///< read end of the result pipe
+  uint32_t index;             ///< of the result
+};
 
+/**
+ * Forks a worker for result index.  Returns 0 in the worker, whose result
+ * goes to fd, and the pid of the worker in the parent, which adds it to
+ * running.
+ */
+static pid_t
+ForkWorker (std::vector<Worker> &running, uint32_t index, int &fd)
+{
+  // buffered output would be written by both processes
+  std::cout.flush ();
+  std::cerr.flush ();
+  std::clog.flush ();
+  int fds[2];
+  NS_ABORT_MSG_IF (pipe (fds) != 0, "pipe failed: " << std::strerror (errno));
+  pid_t pid = fork ();
+  NS_ABORT_MSG_IF (pid < 0, "fork failed: " << std::strerror (errno));
+  if (pid == 0)
+    {
+      close (fds[0]);
+      for (std::vector<Worker>::const_iterator i = running.begin (); i != running.end (); ++i)
+        {
+          close (i->fd);
+        }
+      fd = fds[1];
+      return 0;
+    }
+  close (fds[1]);
+  Worker worker = { pid, fds[0], index };
+  running.push_back (worker);
+  return pid;
+}
 
-// (mobility)
-  /*Simulator::Schedule (Seconds (1.5), &Experiment::AdvancePosition, this, c.Get (1));
-  Ptr<Socket> recvSink = SetupPacketReceive (c.Get (1));
+/**
+ * Appends what the running workers write to their results and reaps the
+ * workers that are done, until at most keep of them are left.
+ */
+static void
+WaitForWorkers (std::vector<Worker> &running, std::vector<std::string> &results, uint32_t keep)
+{
+  while (running.size () > keep)
+    {
+      std::vector<struct pollfd> pfds (running.size ());
+      for (uint32_t i = 0; i < running.size (); i++)
+        {
+          pfds[i].fd = running[i].fd;
+          pfds[i].events = POLLIN;
+          pfds[i].revents = 0;
+        }
+      if (poll (&pfds[0], pfds.size (), -1) < 0)
+        {
+          NS_ABORT_MSG_IF (errno != EINTR, "poll failed: " << std::strerror (errno));
+          continue;
+        }
+      for (uint32_t i = running.size (); i-- > 0; )
+        {
+          if (pfds[i].revents == 0)
+            {
+              continue;
+            }
+          char chunk[65536];
+          ssize_t n = read (running[i].fd, chunk, sizeof (chunk));
+          if (n < 0 && errno == EINTR)
+            {
+              continue;
+            }
+          NS_ABORT_MSG_IF (n < 0, "read from worker failed: " << std::strerror (errno));
+          if (n > 0)
+            {
+              results[running[i].index].append (chunk, n);
+              continue;
+            }
+          close (running[i].fd);
+          int status;
+          while (waitpid (running[i].pid, &status, 0) < 0 && errno == EINTR)
+            {
+            }
+          NS_ABORT_MSG_IF (!WIFEXITED (status) || WEXITSTATUS (status) != 0,
+                           "Worker for job " << running[i].index << " failed");
+          running.erase (running.begin () + i);
+        }
+    }
+}
 
-Simulator::Schedule (Seconds (2.5), &Experiment::AdvancePosition, this, c.Get (2));
-  Ptr<Socket> recvSink1 = SetupPacketReceive (c.Get (2));
+/**
+ * Runs job (0) ... job (count - 1) in forked worker processes, at most jobs at a
+ * time, and returns what each job wrote back indexed by job number.  ns-3's
+ * Simulator is a per-process singleton, so every job gets a fresh process.
+ */
+static std::vector<std::string>
+RunInWorkers (uint32_t count, uint32_t jobs, std::function<std::string (uint32_t)> job)
+{
+  NS_ASSERT (jobs > 0);
+  std::vector<std::string> results (count);
+  std::vector<Worker> running;
+  for (uint32_t next = 0; next < count; next++)
+    {
+      WaitForWorkers (running, results, jobs - 1);
+      int fd;
+      if (ForkWorker (running, next, fd) == 0)
+        {
+          WriteAll (fd, job (next));
+          close (fd);
+          std::cout.flush ();
+          std::cerr.flush ();
+          _exit (0);
+        }
+    }
+  WaitForWorkers (running, results, 0);
+  return results;
+}
+
+/**
+ * Runs the configurations of the sweep listed in indices in a pool of
+ * worker processes; configuration i uses RngRun runBase + i.  Results are
+ * returned in the order of indices.  Every configuration starts from fresh
+ * random streams, whatever ran before it, so its result depends on its
+ * run alone and can be cached.
+ */
+static std::vector<SweepResult>
+RunSweepParallel (const Scenario &scenario, const ExperimentOptions &options,
+                  const std::vector<SweepConfig> &sweep, const std::vector<uint32_t> &indices,
+                  uint32_t jobs, uint32_t runBase)
+{
+  struct Job
+  {
+    static std::string Run (const Scenario *scenario, const ExperimentOptions *options,
+                            const std::vector<SweepConfig> *sweep, const std::vector<uint32_t> *indices,
+                            uint32_t runBase, uint32_t job)
+    {
+      uint32_t index = (*indices)[job];
+      RngSeedManager::SetRun (runBase + index);
+      return EncodeResult (RunSweepConfig (*scenario, *options, (*sweep)[index]));
+    }
+  };
+  std::vector<std::string> results = RunInWorkers (indices.size (), jobs,
+                                                   std::bind (&Job::Run, &scenario, &options, &sweep,
+                                                              &indices, runBase, std::placeholders::_1));
+  std::vector<SweepResult> decoded;
+  for (uint32_t i = 0; i < results.size (); i++)
+    {
+      decoded.push_back (DecodeResult (results[i]));
+    }
+  return decoded;
+}
 
+/**
+ * Runs the configurations of the sweep listed in indices as branches of one
+ * run.  The scenario is built and simulated with the station managers of
+ * configuration warmStart up to the first instant from options.branchAt on
+ * with no frame in flight; there a forked child per configuration swaps in
+ * station managers of its own and simulates the rest, at most jobs children
+ * at a time.  The children inherit every random stream at the branch point
+ * and create their managers in the same order, so a branch depends only on
+ * the random streams of this process and on its configuration; see
+ * RunSweepWarmStarts.  Results are returned in the order of indices.
+ */
+static std::vector<SweepResult>
+RunSweepBranched (const Scenario &scenario, const ExperimentOptions &options,
+                  const std::vector<SweepConfig> &sweep, uint32_t warmStart,
+                  const std::vector<uint32_t> &indices, uint32_t jobs)
+{
+  struct Branches
+  {
+    Experiment *experiment;
+    const ExperimentOptions *options;
+    const std::vector<SweepConfig> *sweep;
+    const std::vector<uint32_t> *indices;
+    uint32_t jobs;
+    std::vector<std::string> results;
+    int fd;                   ///< result pipe when this process is a branch, -1 in the parent
+    uint32_t branch;          ///< index in indices of the branch
+
+    bool Fork (NetDeviceContainer devices)
+    {
+      std::vector<Worker> running;
+      results.resize (indices->size ());
+      for (uint32_t k = 0; k < indices->size (); k++)
+        {
+          WaitForWorkers (running, results, jobs - 1);
+          if (ForkWorker (running, k, fd) == 0)
+            {
+              branch = k;
+              const SweepConfig &config = (*sweep)[(*indices)[k]];
+              NS_LOG_DEBUG (config.name << " branches at " << Simulator::Now ().GetSeconds () << "s");
+              SwapStationManagers (devices, config);
+              if (options->metrics != 0)
+                {
+                  experiment->SetLiveMetrics (options->metrics, options->metrics->FindSlot (config.name),
+                                              Seconds (options->metricsInterval));
+                }
+              if (!options->memoryPrefix.empty ())
+                {
+                  experiment->SetMemoryReport (options->memoryPrefix + config.name + ".csv");
+                }
+              return true;
+            }
+        }
+      WaitForWorkers (running, results, 0);
+      return false;
+    }
+  };
 
-Simulator::Schedule (Seconds (0.5), &Experiment::AdvancePosition, this, c.Get (3));
-  Ptr<Socket> recvSink2 = SetupPacketReceive (c.Get (3));
+  const SweepConfig &first = sweep[indices[0]];
+  NS_LOG_DEBUG (sweep[warmStart].name << " warm start");
+  WifiHelper wifi = MakeWifiHelper (sweep[warmStart]);
+  WifiMacHelper wifiMac;
+  wifiMac.SetType ("ns3::AdhocWifiMac");
+  Experiment experiment (first.name);
+  ConfigureExperiment (experiment, options, first);
+  Branches branches = { &experiment, &options, &sweep, &indices, jobs, std::vector<std::string> (), -1, 0 };
+  experiment.SetBranchPoint (Seconds (options.branchAt),
+                             std::bind (&Branches::Fork, &branches, std::placeholders::_1));
+  experiment.Run (scenario, wifi, MakePhyHelper (options), wifiMac, MakeChannelHelper (options));
+  if (branches.fd >= 0)
+    {
+      const SweepConfig &config = sweep[indices[branches.branch]];
+      WriteAll (branches.fd, EncodeResult (FinishExperiment (experiment, options, config, "")));
+      close (branches.fd);
+      std::cout.flush ();
+      std::cerr.flush ();
+      _exit (0);
+    }
+  NS_ABORT_MSG_IF (experiment.GetStopReason () != "branched",
+                   "The run stopped at " << experiment.GetStopTime ().GetSeconds ()
+                   << "s, before the branch point at " << options.branchAt << "s");
+  std::vector<SweepResult> decoded;
+  for (uint32_t i = 0; i < branches.results.size (); i++)
+    {
+      decoded.push_back (DecodeResult (branches.results[i]));
+    }
+  return decoded;
+}
 
-Simulator::Schedule (Seconds (1.5), &Experiment::AdvancePosition, this, c.Get (4));
-  Ptr<Socket> recvSink3 = SetupPacketReceive (c.Get (4));
+/**
+ * Runs the configurations of the sweep listed in indices as branches of the
+ * warm start warmStarts[i] of each.  Every warm-up runs in a worker process
+ * of its own with RngRun runBase + its warm start, one at a time, so that a
+ * branch depends on that run and its configuration only, whatever else was
+ * run or loaded from the cache.  Results are returned in the order of
+ * indices.
+ */
+static std::vector<SweepResult>
+RunSweepWarmStarts (const Scenario &scenario, const ExperimentOptions &options,
+                    const std::vector<SweepConfig> &sweep, const std::vector<uint32_t> &warmStarts,
+                    const std::vector<uint32_t> &indices, uint32_t jobs, uint32_t runBase)
+{
+  struct Job
+  {
+    static std::string Run (const Scenario *scenario, const ExperimentOptions *options,
+                            const std::vector<SweepConfig> *sweep, const std::vector<uint32_t> *groups,
+                            const std::vector<std::vector<uint32_t> > *branches, uint32_t jobs,
+                            uint32_t runBase, uint32_t job)
+    {
+      RngSeedManager::SetRun (runBase + (*groups)[job]);
+      std::vector<SweepResult> results = RunSweepBranched (*scenario, *options, *sweep, (*groups)[job],
+                                                           (*branches)[job], jobs);
+      std::string buffer;
+      for (uint32_t k = 0; k < results.size (); k++)
+        {
+          AppendString (buffer, EncodeResult (results[k]));
+        }
+      return buffer;
+    }
+  };
+  std::vector<uint32_t> groups;
+  std::vector<std::vector<uint32_t> > branches;
+  for (uint32_t k = 0; k < indices.size (); k++)
+    {
+      uint32_t group = std::find (groups.begin (), groups.end (), warmStarts[indices[k]]) - groups.begin ();
+      if (group == groups.size ())
+        {
+          groups.push_back (warmStarts[indices[k]]);
+          branches.push_back (std::vector<uint32_t> ());
+        }
+      branches[group].push_back (indices[k]);
+    }
+  std::vector<std::string> encoded = RunInWorkers (groups.size (), 1,
+                                                   std::bind (&Job::Run, &scenario, &options, &sweep, &groups,
+                                                              &branches, jobs, runBase, std::placeholders::_1));
+  std::map<uint32_t, SweepResult> results;
+  for (uint32_t group = 0; group < groups.size (); group++)
+    {
+      size_t offset = 0;
+      for (uint32_t k = 0; k < branches[group].size (); k++)
+        {
+          results[branches[group][k]] = DecodeResult (ReadString (encoded[group], offset));
+        }
+      NS_ABORT_MSG_IF (offset != encoded[group].size (), "Warm start result has extra bytes");
+    }
+  std::vector<SweepResult> decoded;
+  for (uint32_t k = 0; k < indices.size (); k++)
+    {
+      decoded.push_back (std::move (results[indices[k]]));
+    }
+  return decoded;
+}
 
-Simulator::Schedule (Seconds (2.5), &Experiment::AdvancePosition, this, c.Get (5));
-  Ptr<Socket> recvSink4 = SetupPacketReceive (c.Get (5));*/
+/**
+ * Writes the packets, mean and quantiles of the delay and jitter of every
+ * flow as CSV, in seconds, followed by a row "all" merging the flows.
+ */
+static void
+WriteDelayStats (std::string path, const SweepResult &result)
+{
+  std::ofstream out (path.c_str ());
+  NS_ABORT_MSG_IF (!out, "Cannot create " << path);
+  out << "flow,packets,delay_mean,delay_p50,delay_p99,delay_p999,jitter_mean,jitter_p50,jitter_p99,jitter_p999"
+      << std::endl;
+  DelayHistogram delays;
+  DelayHistogram jitter;
+  for (uint32_t i = 0; i <= result.delays.size (); i++)
+    {
+      const DelayHistogram *delay = &delays;
+      const DelayHistogram *variation = &jitter;
+      if (i < result.delays.size ())
+        {
+          delay = &result.delays[i];
+          variation = &result.jitter[i];
+          delays.Merge (*delay);
+          jitter.Merge (*variation);
+          out << i;
+        }
+      else
+        {
+          out << "all";
+        }
+      out << "," << delay->GetCount ();
+      const DelayHistogram *histograms[] = { delay, variation };
+      for (uint32_t k = 0; k < 2; k++)
+        {
+          out << "," << histograms[k]->GetMean () / 1e9 << "," << histograms[k]->GetQuantile (0.5) / 1e9
+              << "," << histograms[k]->GetQuantile (0.99) / 1e9 << "," << histograms[k]->GetQuantile (0.999) / 1e9;
+        }
+      out << std::endl;
+    }
+}
 
+/**
+ * Adds every dataset to its plot and writes the plots to stdout in sweep
+ * order.  Streamed results are plotted straight from their series file.
+ */
+static void
+GeneratePlots (const std::vector<SweepConfig> &sweep, const std::vector<SweepResult> &results)
+{
+  Gnuplot gnuplot;
+  for (uint32_t i = 0; i < sweep.size (); i++)
+    {
+      if (i == 0 || sweep[i].plot != sweep[i - 1].plot)
+        {
+          if (i != 0)
+            {
+              gnuplot.GenerateOutput (std::cout);
+            }
+          gnuplot = Gnuplot (sweep[i].plot);
+        }
+      if (!results[i].seriesFile.empty ())
+        {
+          Gnuplot2dFunction series (sweep[i].name, "\"" + results[i].seriesFile + "\" using 1:2");
+          series.SetExtra ("with lines");
+          gnuplot.AddDataset (series);
+          continue;
+        }
+      Gnuplot2dDataset dataset (sweep[i].name);
+      dataset.SetStyle (Gnuplot2dDataset::LINES);
+      const Experiment::Samples &samples = results[i].samples;
+      for (Experiment::Samples::const_iterator j = samples.begin (); j != samples.end (); ++j)
+        {
+          dataset.Add (j->first, j->second);
+        }
+      gnuplot.AddDataset (dataset);
+    }
+  if (!sweep.empty ())
+    {
+      gnuplot.GenerateOutput (std::cout);
+    }
+}
 
-Simulator::Schedule (Seconds (1.5), &Experiment::AdvancePosition, this, c.Get (6));
-  Ptr<Socket> recvSink5 = SetupPacketReceive (c.Get (1));
+/***************************************************************************/
 
-Simulator::Schedule (Seconds (0.6), &Experiment::AdvancePosition, this, c.Get (7));
-  Ptr<Socket> recvSink6 = SetupPacketReceive (c.Get (1));
+/** Result cache **/
+/***************************************************************************/
 
-Simulator::Schedule (Seconds (0.8), &Experiment::AdvancePosition, this, c.Get (8));
-  Ptr<Socket> recvSink7 = SetupPacketReceive (c.Get (1));
+/**
+ * The path, size and modification time of the program and of every shared
+ * library it has mapped, ns-3's among them, from /proc/self/maps; empty if
+ * that cannot be read.  Any rebuild changes it, so cached results never
+ * outlive the code that computed them.
+ */
+static std::string
+DescribeBuild (void)
+{
+  std::ifstream maps ("/proc/self/maps");
+  std::set<std::string> files;
+  std::string line;
+  while (std::getline (maps, line))
+    {
+      // "<range> <permissions> <offset> <device> <inode> <path>"
+      std::istringstream fields (line);
+      std::string range, permissions, offset, device, inode, path;
+      fields >> range >> permissions >> offset >> device >> inode >> path;
+      if (permissions.find ('x') != std::string::npos && !path.empty () && path[0] == '/')
+        {
+          files.insert (path);
+        }
+    }
+  std::ostringstream os;
+  for (std::set<std::string>::const_iterator i = files.begin (); i != files.end (); ++i)
+    {
+      struct stat status;
+      if (stat (i->c_str (), &status) == 0)
+        {
+          os << "binary=" << *i << "," << status.st_size << "," << status.st_mtime << std::endl;
+        }
+    }
+  return os.str ();
+}
 
-Simulator::Schedule (Seconds (0.9), &Experiment::AdvancePosition, this, c.Get (9));
-  Ptr<Socket> recvSink8 = SetupPacketReceive (c.Get (1));
+/**
+ * The canonical description of everything a sweep configuration's result
+ * depends on: the build, the configuration, every option feeding the
+ * channel and the experiment, the scenario, the RNG seed and run, the
+ * attribute defaults changed with Config::SetDefault and the global values.
+ * The PHY, MAC and channel helpers are built from these alone.
+ */
+static std::string
+DescribeRun (const Scenario &scenario, const ExperimentOptions &options, const SweepConfig &config,
+             const SweepConfig &warmStart, uint64_t run)
+{
+  static const std::string build = DescribeBuild ();
+  std::ostringstream os;
+  os.precision (17);
+  os << build
+     << "standard=" << config.standard << std::endl
+     << "manager=" << config.manager << std::endl
+     << "dataMode=" << config.dataMode << std::endl
+     << "channel=" << options.channel << std::endl
+     << "sampleInterval=" << options.sampleInterval << std::endl
+     << "converge=" << options.converge << std::endl
+     << "lazyEnergy=" << options.lazyEnergy << std::endl
+     << "countingSinks=" << options.countingSinks << std::endl
+     << "routing=" << options.routing << std::endl
+     << "tabulatedErrors=" << options.tabulatedErrors << std::endl
+     << "delayStats=" << options.delayStats << std::endl
+     << "energyReport=" << options.energyReport << std::endl;
+  if (options.converge)
+    {
+      options.convergence.Print (os);
+    }
+  if (options.branchAt > 0)
+    {
+      os << "branchAt=" << options.branchAt << std::endl
+         << "warmStart=" << warmStart.manager << "," << warmStart.dataMode << std::endl;
+    }
+  os << "seed=" << RngSeedManager::GetSeed () << std::endl
+     << "run=" << run << std::endl
+     << "initialEnergy=" << scenario.initialEnergy << std::endl
+     << "txCurrent=" << scenario.txCurrent << std::endl;
+  for (std::vector<ScenarioNode>::const_iterator i = scenario.nodes.begin (); i != scenario.nodes.end (); ++i)
+    {
+      os << "node=" << i->position.x << "," << i->position.y << "," << i->position.z << ","
+         << i->advanceStart << std::endl;
+    }
+  for (std::vector<ScenarioFlow>::const_iterator i = scenario.flows.begin (); i != scenario.flows.end (); ++i)
+    {
+      os << "flow=" << i->source << "," << i->destination << "," << i->protocol << "," << i->rate << ","
+         << i->packetSize << "," << i->start << "," << i->stop << std::endl;
+    }
+  for (std::vector<uint32_t>::const_iterator i = scenario.sinks.begin (); i != scenario.sinks.end (); ++i)
+    {
+      os << "sink=" << *i << std::endl;
+    }
+  // Config::SetDefault replaces the initial value of an attribute
+  for (uint32_t i = 0; i < TypeId::GetRegisteredN (); i++)
+    {
+      TypeId tid = TypeId::GetRegistered (i);
+      for (uint32_t j = 0; j < tid.GetAttributeN (); j++)
+        {
+          struct TypeId::AttributeInformation info = tid.GetAttribute (j);
+          if (info.initialValue != info.originalInitialValue)
+            {
+              os << "default=" << tid.GetName () << "::" << info.name << "="
+                 << info.initialValue->SerializeToString (info.checker) << std::endl;
+            }
+        }
+    }
+  for (GlobalValue::Iterator i = GlobalValue::Begin (); i != GlobalValue::End (); ++i)
+    {
+      if ((*i)->GetName () == "RngRun")
+        {
+          continue;
+        }
+      StringValue value;
+      (*i)->GetValue (value);
+      os << "global=" << (*i)->GetName () << "=" << value.Get () << std::endl;
+    }
+  return os.str ();
+}
 
+/// The cache file of a run description: <cacheDir>/<64 bit FNV-1a hash>.result
+static std::string
+GetCachePath (const std::string &cacheDir, const std::string &description)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (std::string::const_iterator i = description.begin (); i != description.end (); ++i)
+    {
+      hash ^= static_cast<unsigned char> (*i);
+      hash *= 1099511628211ULL;
+    }
+  std::ostringstream os;
+  os << cacheDir << "/" << std::hex << std::setw (16) << std::setfill ('0') << hash << ".result";
+  return os.str ();
+}
 
-Simulator::Schedule (Seconds (1.0), &Experiment::AdvancePosition, this, c.Get (10));
-  Ptr<Socket> recvSink9 = SetupPacketReceive (c.Get (1));
+/**
+ * Loads the cached result of a run description.  The file repeats the
+ * description so that hash collisions read as misses.
+ */
+static bool
+LoadCachedResult (const std::string &cacheDir, const std::string &description, SweepResult &result)
+{
+  std::ifstream in (GetCachePath (cacheDir, description).c_str (), std::ios::binary);
+  if (!in)
+    {
+      return false;
+    }
+  std::string buffer ((std::istreambuf_iterator<char> (in)), std::istreambuf_iterator<char> ());
+  size_t offset = 0;
+  if (buffer.size () < sizeof (uint64_t) || ReadString (buffer, offset) != description)
+    {
+      return false;
+    }
+  result = DecodeResult (buffer.substr (offset));
+  return true;
+}
 
-Simulator::Schedule (Seconds (2.0), &Experiment::AdvancePosition, this, c.Get (11));
-  Ptr<Socket> recvSink10 = SetupPacketReceive (c.Get (1));
+/// Stores a result, writing a temporary file first so that readers never see a partial one.
+static void
+StoreCachedResult (const std::string &cacheDir, const std::string &description, const SweepResult &result)
+{
+  NS_ABORT_MSG_IF (mkdir (cacheDir.c_str (), 0777) != 0 && errno != EEXIST,
+                   "Cannot create " << cacheDir << ": " << std::strerror (errno));
+  std::string path = GetCachePath (cacheDir, description);
+  std::ostringstream tmp;
+  tmp << path << ".tmp" << getpid ();
+  std::string buffer;
+  AppendString (buffer, description);
+  buffer += EncodeResult (result);
+  {
+    std::ofstream out (tmp.str ().c_str (), std::ios::binary);
+    NS_ABORT_MSG_IF (!out, "Cannot create " << tmp.str ());
+    out.write (buffer.data (), buffer.size ());
+    NS_ABORT_MSG_IF (!out, "Cannot write " << tmp.str ());
+  }
+  NS_ABORT_MSG_IF (rename (tmp.str ().c_str (), path.c_str ()) != 0,
+                   "Cannot rename " << tmp.str () << ": " << std::strerror (errno));
+}
 
-Simulator::Schedule (Seconds (1.2), &Experiment::AdvancePosition, this, c.Get (12));
-  Ptr<Socket> recvSink11 = SetupPacketReceive (c.Get (1));
+/***************************************************************************/
 
-Simulator::Schedule (Seconds (1.4), &Experiment::AdvancePosition, this, c.Get (13));
-  Ptr<Socket> recvSink12 = SetupPacketReceive (c.Get (1));
+/** Benchmark **/
+/***************************************************************************/
 
-Simulator::Schedule (Seconds (1.5), &Experiment::AdvancePosition, this, c.Get (14));
-  Ptr<Socket> recvSink13 = SetupPacketReceive (c.Get (1));
+/// One case of the benchmark matrix and what it measured.
+struct BenchmarkCase
+{
+  uint32_t nodes;
+  std::string manager;        ///< name of a sweep configuration
+  double duration;            ///< simulated seconds
+  std::string scheduler;      ///< Scheduler TypeId name, empty for the SchedulerType global value
+  Experiment::RunStats stats;
+  uint64_t peakQueue;
+  uint64_t peakRssKb;
+};
 
-Simulator::Schedule (Seconds (1.0), &Experiment::AdvancePosition, this, c.Get (15));
-  Ptr<Socket> recvSink14 = SetupPacketReceive (c.Get (1));
+static std::string
+GetBenchmarkCaseName (const BenchmarkCase &c)
+{
+  std::ostringstream name;
+  name << c.manager << "/" << c.nodes << "n/" << c.duration << "s";
+  if (!c.scheduler.empty ())
+    {
+      name << "/" << c.scheduler;
+    }
+  return name.str ();
+}
 
-/*Simulator::Schedule (Seconds (5.5), &Experiment::AdvancePosition, this, c.Get (16));
-  Ptr<Socket> recvSink15 = SetupPacketReceive (c.Get (16));
+static std::vector<std::string>
+SplitList (std::string list)
+{
+  std::vector<std::string> items;
+  std::istringstream in (list);
+  std::string item;
+  while (std::getline (in, item, ','))
+    {
+      if (!item.empty ())
+        {
+          items.push_back (item);
+        }
+    }
+  return items;
+}
 
-Simulator::Schedule (Seconds (4.5), &Experiment::AdvancePosition, this, c.Get (17));
-  Ptr<Socket> recvSink16 = SetupPacketReceive (c.Get (17));
+/// Scheduler TypeId name of a short name: map, heap, calendar, list or wheel.
+static std::string
+GetSchedulerTypeName (std::string name)
+{
+  if (name == "map" || name == "heap" || name == "calendar" || name == "list")
+    {
+      name[0] = std::toupper (name[0]);
+      return "ns3::" + name + "Scheduler";
+    }
+  if (name == "wheel")
+    {
+      return "ns3::TimingWheelScheduler";
+    }
+  return name;
+}
 
-Simulator::Schedule (Seconds (10.5), &Experiment::AdvancePosition, this, c.Get (18));
-  Ptr<Socket> recvSink17 = SetupPacketReceive (c.Get (18));
+/**
+ * Runs one benchmark case in this process: 16 nodes is the built-in
+ * scenario, larger counts a grid with one flow and one moving node per ten
+ * nodes.  Every flow stops after the case duration.
+ */
+static BenchmarkCase
+RunBenchmarkCase (BenchmarkCase c, const ExperimentOptions &options, const std::vector<SweepConfig> &sweep)
+{
+  Scenario scenario = c.nodes == 16 ? DefaultScenario ()
+    : GenerateScenario ("grid", c.nodes, c.nodes / 10, c.nodes / 10, 20.0, 1);
+  for (std::vector<ScenarioFlow>::iterator i = scenario.flows.begin (); i != scenario.flows.end (); ++i)
+    {
+      i->stop = c.duration;
+    }
+  const SweepConfig *config = 0;
+  for (std::vector<SweepConfig>::const_iterator i = sweep.begin (); i != sweep.end (); ++i)
+    {
+      if (i->name == c.manager)
+        {
+          config = &*i;
+        }
+    }
+  NS_ABORT_MSG_IF (config == 0, "Unknown sweep configuration " << c.manager);
 
-Simulator::Schedule (Seconds (20.5), &Experiment::AdvancePosition, this, c.Get (19));
-  Ptr<Socket> recvSink18 = SetupPacketReceive (c.Get (19));
+  std::string inner = "ns3::MapScheduler";
+  TypeIdValue schedulerType;
+  GlobalValue::GetValueByName ("SchedulerType", schedulerType);
+  if (!c.scheduler.empty ())
+    {
+      inner = c.scheduler;
+    }
+  else if (schedulerType.Get () != DepthTrackingScheduler::GetTypeId ())
+    {
+      inner = schedulerType.Get ().GetName ();
+    }
+  Config::SetDefault ("ns3::DepthTrackingScheduler::Inner", StringValue (inner));
+  GlobalValue::Bind ("SchedulerType", TypeIdValue (DepthTrackingScheduler::GetTypeId ()));
 
-*/
+  WifiHelper wifi = MakeWifiHelper (*config);
+  WifiMacHelper wifiMac;
+  wifiMac.SetType ("ns3::AdhocWifiMac");
+  Experiment experiment (config->name);
+  experiment.SetSampleInterval (Seconds (options.sampleInterval));
+  experiment.SetLazyEnergy (options.lazyEnergy);
+  experiment.SetCountingSinks (options.countingSinks);
+  experiment.SetRouting (options.routing);
+  experiment.Run (scenario, wifi, MakePhyHelper (options), wifiMac, MakeChannelHelper (options));
+
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  c.stats = experiment.GetRunStats ();
+  c.peakQueue = DepthTrackingScheduler::GetPeakDepth ();
+  c.peakRssKb = usage.ru_maxrss;
+  return c;
+}
 
+static std::string
+EncodeBenchmarkCase (const BenchmarkCase &c)
+{
+  std::string buffer;
+  AppendValue (buffer, c.stats);
+  AppendValue (buffer, c.peakQueue);
+  AppendValue (buffer, c.peakRssKb);
+  return buffer;
+}
 
+static void
+DecodeBenchmarkCase (const std::string &buffer, BenchmarkCase &c)
+{
+  size_t offset = 0;
+  c.stats = ReadValue<Experiment::RunStats> (buffer, offset);
+  c.peakQueue = ReadValue<uint64_t> (buffer, offset);
+  c.peakRssKb = ReadValue<uint64_t> (buffer, offset);
+}
 
-  /** Internet stack **/
-/*  InternetStackHelper internet;
-  internet.Install (networkNodes);
+/// Writes the cases as a JSON array holding one case object per line.
+static void
+WriteBenchmarkJson (const std::vector<BenchmarkCase> &cases, std::ostream &os)
+{
+  os << "[" << std::endl;
+  for (uint32_t i = 0; i < cases.size (); i++)
+    {
+      const BenchmarkCase &c = cases[i];
+      double wall = c.stats.setupSeconds + c.stats.runSeconds;
+      os << "  {\"name\": \"" << GetBenchmarkCaseName (c) << "\""
+         << ", \"nodes\": " << c.nodes
+         << ", \"manager\": \"" << c.manager << "\""
+         << ", \"duration\": " << c.duration
+         << ", \"scheduler\": \"" << c.scheduler << "\""
+         << ", \"wall_s\": " << wall
+         << ", \"setup_s\": " << c.stats.setupSeconds
+         << ", \"run_s\": " << c.stats.runSeconds
+         << ", \"events\": " << c.stats.events
+         << ", \"events_per_s\": " << (c.stats.runSeconds > 0 ? c.stats.events / c.stats.runSeconds : 0.0)
+         << ", \"peak_queue\": " << c.peakQueue
+         << ", \"peak_rss_kb\": " << c.peakRssKb
+         << ", \"packets\": " << c.stats.packets
+         << "}" << (i + 1 < cases.size () ? "," : "") << std::endl;
+    }
+  os << "]" << std::endl;
+}
 
-  Ipv4AddressHelper ipv4;
-  NS_LOG_INFO ("Assign IP Addresses.");
-  ipv4.SetBase ("10.1.1.0", "255.255.255.0");
-  Ipv4InterfaceContainer i = ipv4.Assign (devices);
+/// Value of "key" in a line written by WriteBenchmarkJson, or the empty string.
+static std::string
+GetJsonField (const std::string &line, std::string key)
+{
+  std::string pattern = "\"" + key + "\": ";
+  size_t start = line.find (pattern);
+  if (start == std::string::npos)
+    {
+      return "";
+    }
+  start += pattern.size ();
+  if (line[start] == '"')
+    {
+      return line.substr (start + 1, line.find ('"', start + 1) - start - 1);
+    }
+  return line.substr (start, line.find_first_of (",}", start) - start);
+}
 
-  TypeId tid = TypeId::LookupByName ("ns3::UdpSocketFactory");
-  Ptr<Socket> recvSink = Socket::CreateSocket (networkNodes.Get (1), tid);  // node 1, receiver
-  InetSocketAddress local = InetSocketAddress (Ipv4Address::GetAny (), 80);
-  recvSink->Bind (local);
-  recvSink->SetRecvCallback (MakeCallback (&ReceivePacket));
+/**
+ * Compares wall time and peak RSS of every case against a file written by
+ * WriteBenchmarkJson and returns the number of cases that got worse by
+ * more than threshold (a fraction).
+ */
+static uint32_t
+CompareBenchmark (const std::vector<BenchmarkCase> &cases, std::string baseline, double threshold)
+{
+  std::ifstream in (baseline.c_str ());
+  NS_ABORT_MSG_IF (!in, "Cannot open benchmark baseline " << baseline);
+  std::map<std::string, std::pair<double, double> > reference;
+  std::string line;
+  while (std::getline (in, line))
+    {
+      std::string name = GetJsonField (line, "name");
+      if (!name.empty ())
+        {
+          reference[name] = std::make_pair (std::atof (GetJsonField (line, "wall_s").c_str ()),
+                                            std::atof (GetJsonField (line, "peak_rss_kb").c_str ()));
+        }
+    }
+  uint32_t regressions = 0;
+  for (std::vector<BenchmarkCase>::const_iterator i = cases.begin (); i != cases.end (); ++i)
+    {
+      std::string name = GetBenchmarkCaseName (*i);
+      std::map<std::string, std::pair<double, double> >::const_iterator j = reference.find (name);
+      if (j == reference.end ())
+        {
+          std::cerr << name << ": not in baseline" << std::endl;
+          continue;
+        }
+      double wall = i->stats.setupSeconds + i->stats.runSeconds;
+      bool slower = wall > j->second.first * (1 + threshold);
+      bool bigger = i->peakRssKb > j->second.second * (1 + threshold);
+      std::cerr << name << ": wall " << j->second.first << "s -> " << wall << "s, peak rss "
+                << j->second.second << "kB -> " << i->peakRssKb << "kB"
+                << (slower || bigger ? "  REGRESSION" : "") << std::endl;
+      regressions += slower || bigger;
+    }
+  return regressions;
+}
 
-  Ptr<Socket> source = Socket::CreateSocket (networkNodes.Get (0), tid);    // node 0, sender
-  InetSocketAddress remote = InetSocketAddress (Ipv4Address::GetBroadcast (), 80);
-  source->SetAllowBroadcast (true);
-  source->Connect (remote);*/
+/**
+ * Runs every case of the matrix in its own worker process, one at a time.
+ * An empty scheduler list runs each case once with the SchedulerType
+ * global value.
+ */
+static std::vector<BenchmarkCase>
+RunBenchmark (std::string nodes, std::string managers, std::string durations, std::string schedulers,
+              const ExperimentOptions &options, const std::vector<SweepConfig> &sweep)
+{
+  struct Job
+  {
+    static std::string Run (const std::vector<BenchmarkCase> *cases, const ExperimentOptions *options,
+                            const std::vector<SweepConfig> *sweep, uint32_t index)
+    {
+      return EncodeBenchmarkCase (RunBenchmarkCase ((*cases)[index], *options, *sweep));
+    }
+  };
+  std::vector<BenchmarkCase> cases;
+  std::vector<std::string> nodeList = SplitList (nodes);
+  std::vector<std::string> managerList = SplitList (managers);
+  std::vector<std::string> durationList = SplitList (durations);
+  std::vector<std::string> schedulerList = SplitList (schedulers);
+  if (schedulerList.empty ())
+    {
+      schedulerList.push_back ("");
+    }
+  for (uint32_t i = 0; i < nodeList.size (); i++)
+    {
+      for (uint32_t j = 0; j < managerList.size (); j++)
+        {
+          for (uint32_t k = 0; k < durationList.size (); k++)
+            {
+              for (uint32_t l = 0; l < schedulerList.size (); l++)
+                {
+                  BenchmarkCase c;
+                  c.nodes = std::atoi (nodeList[i].c_str ());
+                  c.manager = managerList[j];
+                  c.duration = std::atof (durationList[k].c_str ());
+                  c.scheduler = GetSchedulerTypeName (schedulerList[l]);
+                  cases.push_back (c);
+                }
+            }
+        }
+    }
+  // one case at a time so that cases do not compete for cores and memory bandwidth
+  std::vector<std::string> results = RunInWorkers (cases.size (), 1,
+                                                   std::bind (&Job::Run, &cases, &options, &sweep,
+                                                              std::placeholders::_1));
+  for (uint32_t i = 0; i < cases.size (); i++)
+    {
+      DecodeBenchmarkCase (results[i], cases[i]);
+    }
+  return cases;
+}
 
+/***************************************************************************/
 
-/** connect trace sources **/
-  /***************************************************************************/
-  // all sources are connected to node 1
-  // energy source
-  Ptr<BasicEnergySource> basicSourcePtr = DynamicCast<BasicEnergySource> (sources.Get (1));
-  basicSourcePtr->TraceConnectWithoutContext ("RemainingEnergy", MakeCallback (&RemainingEnergy));
-
-/*Ptr<BasicEnergySource> basicSourcePtr1 = DynamicCast<BasicEnergySource> (sources.Get (1));
-  basicSourcePtr1->TraceConnectWithoutContext ("RemainingEnergy", MakeCallback (&RemainingEnergy));
-  
-Ptr<BasicEnergySource> basicSourcePtr2 = DynamicCast<BasicEnergySource> (sources.Get (1));
-  basicSourcePtr2->TraceConnectWithoutContext ("RemainingEnergy", MakeCallback (&RemainingEnergy));
-  
-Ptr<BasicEnergySource> basicSourcePtr3 = DynamicCast<BasicEnergySource> (sources.Get (1));
-  basicSourcePtr3->TraceConnectWithoutContext ("RemainingEnergy", MakeCallback (&RemainingEnergy));*/
-  
-  // device energy model
-  Ptr<DeviceEnergyModel> basicRadioModelPtr = basicSourcePtr->FindDeviceEnergyModels ("ns3::WifiRadioEnergyModel").Get (0);
-  NS_ASSERT (basicRadioModelPtr != NULL);
-  basicRadioModelPtr->TraceConnectWithoutContext ("TotalEnergyConsumption", MakeCallback (&TotalEnergy));
-
-/*Ptr<DeviceEnergyModel> basicRadioModelPtr1 = basicSourcePtr->FindDeviceEnergyModels ("ns3::WifiRadioEnergyModel").Get (0);
-  NS_ASSERT (basicRadioModelPtr1 != NULL);
-  basicRadioModelPtr1->TraceConnectWithoutContext ("TotalEnergyConsumption", MakeCallback (&TotalEnergy));
-  
-Ptr<DeviceEnergyModel> basicRadioModelPtr2 = basicSourcePtr->FindDeviceEnergyModels ("ns3::WifiRadioEnergyModel").Get (0);
-  NS_ASSERT (basicRadioModelPtr2 != NULL);
-  basicRadioModelPtr2->TraceConnectWithoutContext ("TotalEnergyConsumption", MakeCallback (&TotalEnergy));
-  
-Ptr<DeviceEnergyModel> basicRadioModelPtr3 = basicSourcePtr->FindDeviceEnergyModels ("ns3::WifiRadioEnergyModel").Get (0);
-  NS_ASSERT (basicRadioModelPtr3 != NULL);
-  basicRadioModelPtr3->TraceConnectWithoutContext ("TotalEnergyConsumption", MakeCallback (&TotalEnergy));*/
-    
+/** Tests **/
 /***************************************************************************/
 
+/// The built-in scenario with every flow stopping at stop seconds.
+static Scenario
+MakeTestScenario (double stop)
+{
+  Scenario scenario = DefaultScenario ();
+  for (std::vector<ScenarioFlow>::iterator i = scenario.flows.begin (); i != scenario.flows.end (); ++i)
+    {
+      i->stop = stop;
+    }
+  return scenario;
+}
+
+/**
+ * Runs a constant rate and a rate control configuration with periodic and
+ * with lazy energy accounting.  The batteries hold 10 J, so that every
+ * node drains after about 10 s while its radio keeps changing state.  The
+ * drain instants and the throughput samples must be the same in both
+ * modes, the energy left when the runs stop the same up to rounding.
+ */
+class LazyEnergyTestCase : public TestCase
+{
+public:
+  LazyEnergyTestCase ();
+private:
+  virtual void DoRun (void);
+};
 
+LazyEnergyTestCase::LazyEnergyTestCase ()
+  : TestCase ("Lazy energy accounting drains the batteries when periodic updates do")
+{
+}
 
-  Simulator::Run ();
+void
+LazyEnergyTestCase::DoRun (void)
+{
+  Scenario scenario = MakeTestScenario (30.0);
+  scenario.initialEnergy = 10.0;
+  ExperimentOptions options = DefaultExperimentOptions ();
+  options.energyReport = true;
+  std::vector<SweepConfig> sweep = DefaultSweep ();
+  std::vector<uint32_t> indices;
+  indices.push_back (FindSweepConfig (sweep, "54mb"));
+  indices.push_back (FindSweepConfig (sweep, "arf"));
+  std::vector<SweepResult> periodic = RunSweepParallel (scenario, options, sweep, indices, 1, 1);
+  options.lazyEnergy = true;
+  std::vector<SweepResult> lazy = RunSweepParallel (scenario, options, sweep, indices, 1, 1);
+  for (uint32_t i = 0; i < indices.size (); i++)
+    {
+      const std::string &name = sweep[indices[i]].name;
+      const SweepResult &p = periodic[i];
+      const SweepResult &l = lazy[i];
+      NS_TEST_ASSERT_MSG_EQ (p.finalEnergy.size (), scenario.nodes.size (), name << ": no energy report");
+      NS_TEST_ASSERT_MSG_EQ (l.finalEnergy.size (), p.finalEnergy.size (), name << ": node counts differ");
+      for (uint32_t j = 0; j < p.finalEnergy.size (); j++)
+        {
+          NS_TEST_EXPECT_MSG_GT (p.depletionTimes[j], 0.0, name << ": node " << j << " never drained");
+          NS_TEST_EXPECT_MSG_EQ (l.depletionTimes[j], p.depletionTimes[j],
+                                 name << ": node " << j << " drained at another instant");
+          NS_TEST_EXPECT_MSG_EQ_TOL (l.finalEnergy[j], p.finalEnergy[j], 1e-9 * scenario.initialEnergy,
+                                     name << ": node " << j << " ended with another energy");
+        }
+      NS_TEST_EXPECT_MSG_EQ (l.stopTime, p.stopTime, name << ": the runs stopped at other instants");
+      NS_TEST_EXPECT_MSG_EQ ((l.samples == p.samples), true, name << ": the throughput samples differ");
+    }
+}
 
-  Simulator::Destroy ();
+/**
+ * Branches the runs of the built-in scenario at 5 s, in three ways.  A
+ * warm-up forked twice into the same configuration must give two equal
+ * branches, and a warm-up run again in another process the same branch as
+ * well.  A constant rate configuration branched from its own warm-up only
+ * gets new station managers of the same kind, which hold no state between
+ * frame exchanges, so the branch must equal the run from scratch with the
+ * same RngRun.
+ */
+class BranchTestCase : public TestCase
+{
+public:
+  BranchTestCase ();
+private:
+  virtual void DoRun (void);
+};
 
-  return m_output;
+BranchTestCase::BranchTestCase ()
+  : TestCase ("Branches match each other and the run from scratch")
+{
+}
+
+void
+BranchTestCase::DoRun (void)
+{
+  struct Job
+  {
+    /// Forks the warm-up of warmStart into every configuration of indices, with RngRun 1 + warmStart.
+    static std::string Run (const Scenario *scenario, const ExperimentOptions *options,
+                            const std::vector<SweepConfig> *sweep, uint32_t warmStart,
+                            const std::vector<uint32_t> *indices, uint32_t job)
+    {
+      RngSeedManager::SetRun (1 + warmStart);
+      std::vector<SweepResult> results = RunSweepBranched (*scenario, *options, *sweep, warmStart, *indices, 1);
+      std::string buffer;
+      for (uint32_t k = 0; k < results.size (); k++)
+        {
+          AppendString (buffer, EncodeResult (results[k]));
+        }
+      return buffer;
+    }
+  };
+
+  Scenario scenario = MakeTestScenario (15.0);
+  ExperimentOptions options = DefaultExperimentOptions ();
+  options.branchAt = 5.0;
+  std::vector<SweepConfig> sweep = DefaultSweep ();
+  uint32_t arf = FindSweepConfig (sweep, "arf");
+  uint32_t aarf = FindSweepConfig (sweep, "aarf");
+  uint32_t constant = FindSweepConfig (sweep, "54mb");
+
+  std::vector<uint32_t> twice (2, aarf);
+  std::string buffer = RunInWorkers (1, 1, std::bind (&Job::Run, &scenario, &options, &sweep, arf, &twice,
+                                                      std::placeholders::_1))[0];
+  size_t offset = 0;
+  SweepResult first = DecodeResult (ReadString (buffer, offset));
+  SweepResult second = DecodeResult (ReadString (buffer, offset));
+  NS_TEST_ASSERT_MSG_EQ (first.samples.empty (), false, "the branch has no samples");
+  NS_TEST_EXPECT_MSG_EQ (first.stopTime, 15.0, "the branch stopped at another instant");
+  NS_TEST_EXPECT_MSG_EQ ((second.samples == first.samples), true, "two branches of one warm-up differ");
+  NS_TEST_EXPECT_MSG_EQ (second.stopTime, first.stopTime, "two branches of one warm-up stopped apart");
+
+  std::vector<uint32_t> warmStarts (sweep.size ());
+  for (uint32_t i = 0; i < sweep.size (); i++)
+    {
+      warmStarts[i] = i;
+    }
+  warmStarts[aarf] = arf;
+  std::vector<uint32_t> indices;
+  indices.push_back (aarf);
+  indices.push_back (constant);
+  std::vector<SweepResult> branched = RunSweepWarmStarts (scenario, options, sweep, warmStarts, indices, 1, 1);
+  NS_TEST_EXPECT_MSG_EQ ((branched[0].samples == first.samples), true,
+                         "the branches of two runs of one warm-up differ");
+
+  options.branchAt = 0.0;
+  std::vector<SweepResult> scratch = RunSweepParallel (scenario, options, sweep,
+                                                       std::vector<uint32_t> (1, constant), 1, 1);
+  NS_TEST_EXPECT_MSG_EQ (branched[1].stopTime, scratch[0].stopTime, "the branch stopped apart from the run");
+  NS_TEST_EXPECT_MSG_EQ ((branched[1].samples == scratch[0].samples), true,
+                         "the branch differs from the run from scratch");
+}
+
+#ifdef SAMPLE2_MEMORY_ACCOUNTING
+/// Bytes a node may hold at the end of a MemoryScalingTestCase run.
+static const double MEMORY_BUDGET_PER_NODE = 4.0 * 1024 * 1024;
+
+/**
+ * Runs grids of 16 and of 64 nodes, with a flow from every fourth node,
+ * with memory accounting.  The bytes held per node at the end of the runs
+ * must stay under MEMORY_BUDGET_PER_NODE and grow by less than half from
+ * the small grid to the large one: anything a node keeps per other node,
+ * such as a loss cache of every pair, shows up as growth.
+ */
+class MemoryScalingTestCase : public TestCase
+{
+public:
+  MemoryScalingTestCase ();
+private:
+  virtual void DoRun (void);
+};
+
+MemoryScalingTestCase::MemoryScalingTestCase ()
+  : TestCase ("Memory held per node stays within budget as the network grows")
+{
+}
+
+void
+MemoryScalingTestCase::DoRun (void)
+{
+  struct Job
+  {
+    static std::string Run (uint32_t i)
+    {
+      // in a worker, so that the tags do not outlive the case
+      EnableSchedulerTracking ();
+      EnableMemoryAccounting ();
+      uint32_t nodes = 16 << (2 * i);
+      Scenario scenario = GenerateScenario ("grid", nodes, nodes / 4, 0, 20.0, 1);
+      for (std::vector<ScenarioFlow>::iterator j = scenario.flows.begin (); j != scenario.flows.end (); ++j)
+        {
+          j->stop = 10.0;
+        }
+      ExperimentOptions options = DefaultExperimentOptions ();
+      std::vector<SweepConfig> sweep = DefaultSweep ();
+      std::vector<uint32_t> indices (1, FindSweepConfig (sweep, "54mb"));
+      return EncodeResult (RunSweepParallel (scenario, options, sweep, indices, 1, 1)[0]);
+    }
+  };
+
+  std::vector<std::string> encoded = RunInWorkers (2, 1, &Job::Run);
+  double small = DecodeResult (encoded[0]).memoryPerNode;
+  double large = DecodeResult (encoded[1]).memoryPerNode;
+  NS_TEST_ASSERT_MSG_GT (small, 0.0, "no allocation was tagged with a node");
+  NS_TEST_EXPECT_MSG_LT (small, MEMORY_BUDGET_PER_NODE, "16 nodes hold " << small << " bytes each");
+  NS_TEST_EXPECT_MSG_LT (large, MEMORY_BUDGET_PER_NODE, "64 nodes hold " << large << " bytes each");
+  NS_TEST_EXPECT_MSG_LT (large, 1.5 * small,
+                         "bytes per node grew from " << small << " with 16 nodes to " << large << " with 64");
+}
+#endif /* SAMPLE2_MEMORY_ACCOUNTING */
+
+/**
+ * End-to-end checks of this program.  Every case runs its simulations in
+ * worker processes, as the sweeps do.
+ */
+class Sample2TestSuite : public TestSuite
+{
+public:
+  Sample2TestSuite ();
+};
+
+Sample2TestSuite::Sample2TestSuite ()
+  : TestSuite ("sample2", SYSTEM)
+{
+  AddTestCase (new LazyEnergyTestCase, TestCase::QUICK);
+  AddTestCase (new BranchTestCase, TestCase::QUICK);
+#ifdef SAMPLE2_MEMORY_ACCOUNTING
+  AddTestCase (new MemoryScalingTestCase, TestCase::QUICK);
+#endif
 }
 
+/// Registers the suite with the test runner of --test.
+static Sample2TestSuite g_sample2TestSuite;
+
+/***************************************************************************/
+
 int main (int argc, char *argv[])
 {
   // disable fragmentation
   Config::SetDefault ("ns3::WifiRemoteStationManager::FragmentationThreshold", StringValue ("2200"));
   Config::SetDefault ("ns3::WifiRemoteStationManager::RtsCtsThreshold", StringValue ("2200"));
 
+  // --test [--suite=sample2] [--verbose] ...: run Sample2TestSuite, the other arguments go to the test runner
+  if (argc > 1 && std::string (argv[1]) == "--test")
+    {
+      argv[1] = argv[0];
+      return TestRunner::Run (argc - 1, argv + 1);
+    }
+
+  uint32_t jobs = 1;
+  uint32_t runBase = 1;
+  std::string scenarioFile;
+  std::string layout;
+  uint32_t nodes = 1000;
+  uint32_t flows = 100;
+  uint32_t mobile = 0;
+  double spacing = 20.0;
+  uint32_t seed = 1;
+  ExperimentOptions options = DefaultExperimentOptions ();
+  double precision = 0.05;
+  double absPrecision = 0.01;
+  uint32_t batches = 10;
+  uint32_t minBatchSize = 5;
+  double warmup = 10.0;
+  std::string traceFile;
+  std::string traceFormat = "csv";
+  std::string benchmark;
+  std::string benchNodes = "16,1000,10000";
+  std::string benchManagers = "54mb,arf";
+  std::string benchDurations = "10,60";
+  std::string benchSchedulers;
+  std::string benchBaseline;
+  double benchThreshold = 0.10;
+  bool profile = false;
+  std::string cacheDir;
+  std::string delayStatsPrefix;
+  std::string metricsFile;
+  std::string monitor;
+  double monitorPeriod = 1.0;
+
   CommandLine cmd;
+  cmd.AddValue ("jobs", "Number of worker processes running sweep configurations concurrently", jobs);
+  cmd.AddValue ("runBase", "RngRun of the first configuration; configuration i uses runBase + i whatever the number of jobs", runBase);
+  cmd.AddValue ("scenario", "CSV or JSON scenario file replacing the built-in 16 node scenario", scenarioFile);
+  cmd.AddValue ("layout", "Generate a grid or random scenario instead of the built-in one", layout);
+  cmd.AddValue ("nodes", "Number of nodes of a generated scenario", nodes);
+  cmd.AddValue ("flows", "Number of flows of a generated scenario", flows);
+  cmd.AddValue ("mobile", "Number of moving nodes of a generated scenario", mobile);
+  cmd.AddValue ("spacing", "Mean distance in meters between neighbours of a generated scenario", spacing);
+  cmd.AddValue ("seed", "Seed of the random layout", seed);
+  cmd.AddValue ("channel", "Wifi channel: yans, or cached to reuse the loss between nodes at rest", options.channel);
+  cmd.AddValue ("tracePrefix", "Record the energy of every node into binary files <tracePrefix><name>.trace", options.tracePrefix);
+  cmd.AddValue ("sampleInterval", "Seconds between throughput samples", options.sampleInterval);
+  cmd.AddValue ("flowStatsPrefix", "Write per-sink and per-flow byte counters to <flowStatsPrefix><name>.csv", options.flowStatsPrefix);
+  cmd.AddValue ("delayStatsPrefix", "Measure the delay and jitter of every flow and write their quantiles to <delayStatsPrefix><name>.csv", delayStatsPrefix);
+  cmd.AddValue ("converge", "Stop every run once its throughput has converged", options.converge);
+  cmd.AddValue ("precision", "Relative half-width of the throughput confidence interval that ends a run", precision);
+  cmd.AddValue ("absPrecision", "Half-width in Mbit/s of the throughput confidence interval that ends a run", absPrecision);
+  cmd.AddValue ("batches", "Number of batches of the batch means", batches);
+  cmd.AddValue ("minBatchSize", "Samples per batch needed before testing convergence", minBatchSize);
+  cmd.AddValue ("warmup", "Seconds of throughput samples ignored by the convergence test", warmup);
+  cmd.AddValue ("lazyEnergy", "Integrate energy on radio state changes instead of every second", options.lazyEnergy);
+  cmd.AddValue ("routing", "none for one hop packet socket flows, olsr for UDP flows routed by OLSR", options.routing);
+  cmd.AddValue ("tabulatedErrors", "Interpolate chunk success rates from per-mode tables of the NIST error model", options.tabulatedErrors);
+  cmd.AddValue ("countingSinks", "Count sink traffic from the receive notification without packet sockets", options.countingSinks);
+  cmd.AddValue ("traceFile", "Convert a binary trace file to traceFormat on stdout and exit", traceFile);
+  cmd.AddValue ("traceFormat", "Output of traceFile: csv or gnuplot", traceFormat);
+  cmd.AddValue ("profile", "Print the wall time spent in each event type when a run ends", profile);
+  cmd.AddValue ("profilePrefix", "Also write the event profiles to <profilePrefix><name>.folded for flamegraph.pl", options.profilePrefix);
+  cmd.AddValue ("seriesPrefix", "Stream the throughput samples to <seriesPrefix><name>.dat and plot from those files", options.seriesPrefix);
+  cmd.AddValue ("seriesBucket", "Keep the lowest and highest of every seriesBucket samples in the series files", options.seriesBucket);
+  cmd.AddValue ("memoryPrefix", "Tag allocations and write the bytes held per node and component to <memoryPrefix><name>.csv; needs a build with SAMPLE2_MEMORY_ACCOUNTING", options.memoryPrefix);
+  cmd.AddValue ("branchAt", "Simulate the configurations of a standard as branches forked at the first instant without frames in flight from this many seconds of a shared run on, 0 to run each from scratch", options.branchAt);
+  cmd.AddValue ("metricsFile", "Publish the live counters of every configuration to this memory-mapped file", metricsFile);
+  cmd.AddValue ("metricsInterval", "Simulated seconds between two publications to metricsFile", options.metricsInterval);
+  cmd.AddValue ("monitor", "Print the live counters in the metricsFile of another run and exit", monitor);
+  cmd.AddValue ("monitorPeriod", "Seconds between two prints of monitor until every configuration is done, 0 to print once", monitorPeriod);
+  cmd.AddValue ("cacheDir", "Reuse the results of unchanged configurations stored in this directory", cacheDir);
+  cmd.AddValue ("benchmark", "Run the benchmark matrix and write its JSON results to this file", benchmark);
+  cmd.AddValue ("benchNodes", "Comma separated node counts of the benchmark matrix", benchNodes);
+  cmd.AddValue ("benchManagers", "Comma separated sweep configuration names of the benchmark matrix", benchManagers);
+  cmd.AddValue ("benchDurations", "Comma separated simulated seconds of the benchmark matrix", benchDurations);
+  cmd.AddValue ("benchSchedulers", "Comma separated schedulers of the benchmark matrix: map, heap, calendar, list, wheel or a TypeId name", benchSchedulers);
+  cmd.AddValue ("benchBaseline", "Benchmark JSON to compare against; regressions make the program fail", benchBaseline);
+  cmd.AddValue ("benchThreshold", "Fraction by which wall time or peak RSS may grow over the baseline", benchThreshold);
   cmd.Parse (argc, argv);
 
-  Gnuplot gnuplot = Gnuplot ("reference-rates.png");
+  // the worker pools keep jobs - 1 workers running while they fork the next one
+  NS_ABORT_MSG_IF (jobs == 0, "jobs must be at least 1");
+  options.convergence.Configure (precision, absPrecision, batches, minBatchSize, Seconds (warmup));
+  options.delayStats = !delayStatsPrefix.empty ();
+  if (profile || !options.profilePrefix.empty ())
+    {
+      GlobalValue::Bind ("SimulatorImplementationType", StringValue ("ns3::ProfilingSimulatorImpl"));
+    }
+  if (!options.memoryPrefix.empty ())
+    {
+      EnableMemoryAccounting ();
+    }
 
-  Experiment experiment;
-  WifiHelper wifi;
-  wifi.SetStandard (WIFI_PHY_STANDARD_80211a);
-  WifiMacHelper wifiMac;
-  YansWifiPhyHelper wifiPhy = YansWifiPhyHelper::Default ();
-  YansWifiChannelHelper wifiChannel = YansWifiChannelHelper::Default ();
-  Gnuplot2dDataset dataset;
+  if (!traceFile.empty ())
+    {
+      ConvertTraceFile (traceFile, traceFormat, std::cout);
+      return 0;
+    }
 
-  wifiMac.SetType ("ns3::AdhocWifiMac");
+  if (!monitor.empty ())
+    {
+      MonitorMetricsPage (monitor, monitorPeriod, std::cout);
+      return 0;
+    }
+
+  if (!benchmark.empty ())
+    {
+      std::vector<BenchmarkCase> cases = RunBenchmark (benchNodes, benchManagers, benchDurations,
+                                                       benchSchedulers, options, DefaultSweep ());
+      std::ofstream out (benchmark.c_str ());
+      NS_ABORT_MSG_IF (!out, "Cannot create " << benchmark);
+      WriteBenchmarkJson (cases, out);
+      if (!benchBaseline.empty () && CompareBenchmark (cases, benchBaseline, benchThreshold) != 0)
+        {
+          return 1;
+        }
+      return 0;
+    }
+
+  Scenario scenario;
+  if (!scenarioFile.empty ())
+    {
+      scenario = LoadScenario (scenarioFile);
+    }
+  else if (!layout.empty ())
+    {
+      scenario = GenerateScenario (layout, nodes, flows, mobile, spacing, seed);
+    }
+  else
+    {
+      scenario = DefaultScenario ();
+    }
 
-  NS_LOG_DEBUG ("54");
-  experiment = Experiment ("54mb");
-  wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
-                                "DataMode", StringValue ("OfdmRate54Mbps"));
-  dataset = experiment.Run (wifi, wifiPhy, wifiMac, wifiChannel);
-  gnuplot.AddDataset (dataset);
-
-  NS_LOG_DEBUG ("48");
-  experiment = Experiment ("48mb");
-  wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
-                                "DataMode", StringValue ("OfdmRate48Mbps"));
-  dataset = experiment.Run (wifi, wifiPhy, wifiMac, wifiChannel);
-  gnuplot.AddDataset (dataset);
-
-  NS_LOG_DEBUG ("36");
-  experiment = Experiment ("36mb");
-  wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
-                                "DataMode", StringValue ("OfdmRate36Mbps"));
-  dataset = experiment.Run (wifi, wifiPhy, wifiMac, wifiChannel);
-  gnuplot.AddDataset (dataset);
-
-  NS_LOG_DEBUG ("24");
-  experiment = Experiment ("24mb");
-  wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
-                                "DataMode", StringValue ("OfdmRate24Mbps"));
-  dataset = experiment.Run (wifi, wifiPhy, wifiMac, wifiChannel);
-  gnuplot.AddDataset (dataset);
-
-  NS_LOG_DEBUG ("18");
-  experiment = Experiment ("18mb");
-  wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
-                                "DataMode", StringValue ("OfdmRate18Mbps"));
-  dataset = experiment.Run (wifi, wifiPhy, wifiMac, wifiChannel);
-  gnuplot.AddDataset (dataset);
-
-  NS_LOG_DEBUG ("12");
-  experiment = Experiment ("12mb");
-  wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
-                                "DataMode", StringValue ("OfdmRate12Mbps"));
-  dataset = experiment.Run (wifi, wifiPhy, wifiMac, wifiChannel);
-  gnuplot.AddDataset (dataset);
-
-  NS_LOG_DEBUG ("9");
-  experiment = Experiment ("9mb");
-  wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
-                                "DataMode", StringValue ("OfdmRate9Mbps"));
-  dataset = experiment.Run (wifi, wifiPhy, wifiMac, wifiChannel);
-  gnuplot.AddDataset (dataset);
-
-  NS_LOG_DEBUG ("6");
-  experiment = Experiment ("6mb");
-  wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
-                                "DataMode", StringValue ("OfdmRate6Mbps"));
-  dataset = experiment.Run (wifi, wifiPhy, wifiMac, wifiChannel);
-  gnuplot.AddDataset (dataset);
-
-  gnuplot.GenerateOutput (std::cout);
-
-
-  gnuplot = Gnuplot ("rate-control.png");
-  wifi.SetStandard (WIFI_PHY_STANDARD_holland);
-
-
-  NS_LOG_DEBUG ("arf");
-  experiment = Experiment ("arf");
-  wifi.SetRemoteStationManager ("ns3::ArfWifiManager");
-  dataset = experiment.Run (wifi, wifiPhy, wifiMac, wifiChannel);
-  gnuplot.AddDataset (dataset);
-
-  NS_LOG_DEBUG ("aarf");
-  experiment = Experiment ("aarf");
-  wifi.SetRemoteStationManager ("ns3::AarfWifiManager");
-  dataset = experiment.Run (wifi, wifiPhy, wifiMac, wifiChannel);
-  gnuplot.AddDataset (dataset);
-
-  NS_LOG_DEBUG ("aarf-cd");
-  experiment = Experiment ("aarf-cd");
-  wifi.SetRemoteStationManager ("ns3::AarfcdWifiManager");
-  dataset = experiment.Run (wifi, wifiPhy, wifiMac, wifiChannel);
-  gnuplot.AddDataset (dataset);
-
-  NS_LOG_DEBUG ("cara");
-  experiment = Experiment ("cara");
-  wifi.SetRemoteStationManager ("ns3::CaraWifiManager");
-  dataset = experiment.Run (wifi, wifiPhy, wifiMac, wifiChannel);
-  gnuplot.AddDataset (dataset);
-
-  NS_LOG_DEBUG ("rraa");
-  experiment = Experiment ("rraa");
-  wifi.SetRemoteStationManager ("ns3::RraaWifiManager");
-  dataset = experiment.Run (wifi, wifiPhy, wifiMac, wifiChannel);
-  gnuplot.AddDataset (dataset);
-
-  NS_LOG_DEBUG ("ideal");
-  experiment = Experiment ("ideal");
-  wifi.SetRemoteStationManager ("ns3::IdealWifiManager");
-  dataset = experiment.Run (wifi, wifiPhy, wifiMac, wifiChannel);
-  gnuplot.AddDataset (dataset);
-
-  gnuplot.GenerateOutput (std::cout);
+  if (!cacheDir.empty ()
+      && !(options.tracePrefix.empty () && options.flowStatsPrefix.empty () && !profile
+           && options.profilePrefix.empty () && options.seriesPrefix.empty () && options.memoryPrefix.empty ()))
+    {
+      // cached runs would not produce their side files or reports
+      std::cerr << "cacheDir ignored: trace, flow stats, profile, series or memory reports requested" << std::endl;
+      cacheDir.clear ();
+    }
+  if (!cacheDir.empty () && DescribeBuild ().empty ())
+    {
+      std::cerr << "cacheDir ignored: the build cannot be identified without /proc/self/maps" << std::endl;
+      cacheDir.clear ();
+    }
+  std::vector<SweepConfig> sweep = DefaultSweep ();
+  LiveMetricsPage metricsPage;
+  if (!metricsFile.empty ())
+    {
+      std::vector<std::string> names;
+      for (uint32_t i = 0; i < sweep.size (); i++)
+        {
+          names.push_back (sweep[i].name);
+        }
+      metricsPage.Create (metricsFile, names, scenario.nodes.size ());
+      options.metrics = &metricsPage;
+    }
+  // the queue size of the live counters and the node of the running event
+  // of memory accounting come from a DepthTrackingScheduler
+  if (!metricsFile.empty () || !options.memoryPrefix.empty ())
+    {
+      EnableSchedulerTracking ();
+    }
+  NS_ABORT_MSG_IF (options.branchAt > 0 && !(options.tracePrefix.empty () && options.seriesPrefix.empty ()
+                                               && options.profilePrefix.empty ()),
+                   "branchAt cannot be combined with tracePrefix, seriesPrefix or profilePrefix");
+  // branching is only tested with the one hop unicast flows of routing=none
+  NS_ABORT_MSG_IF (options.branchAt > 0 && options.routing != "none", "branchAt needs routing=none");
+  // a configuration branches from the first configuration of its standard, hence of its PHY
+  std::vector<uint32_t> warmStarts (sweep.size ());
+  for (uint32_t i = 0; i < sweep.size (); i++)
+    {
+      warmStarts[i] = i;
+      for (uint32_t j = 0; options.branchAt > 0 && j < i && warmStarts[i] == i; j++)
+        {
+          if (sweep[j].standard == sweep[i].standard)
+            {
+              warmStarts[i] = j;
+            }
+        }
+    }
+  std::vector<SweepResult> results (sweep.size ());
+  std::vector<std::string> descriptions (sweep.size ());
+  std::vector<uint32_t> pending;
+  for (uint32_t i = 0; i < sweep.size (); i++)
+    {
+      if (!cacheDir.empty ())
+        {
+          descriptions[i] = DescribeRun (scenario, options, sweep[i], sweep[warmStarts[i]], runBase + warmStarts[i]);
+          if (LoadCachedResult (cacheDir, descriptions[i], results[i]))
+            {
+              if (options.metrics != 0)
+                {
+                  LiveMetrics cached = LiveMetrics ();
+                  cached.state = LIVE_CACHED;
+                  options.metrics->Publish (i, cached);
+                }
+              continue;
+            }
+        }
+      pending.push_back (i);
+    }
+  // even with one job: the automatic stream indices carry over between runs of a process
+  std::vector<SweepResult> ran = options.branchAt > 0
+    ? RunSweepWarmStarts (scenario, options, sweep, warmStarts, pending, jobs, runBase)
+    : RunSweepParallel (scenario, options, sweep, pending, jobs, runBase);
+  for (uint32_t k = 0; k < pending.size (); k++)
+    {
+      results[pending[k]] = std::move (ran[k]);
+    }
+  if (!cacheDir.empty ())
+    {
+      for (uint32_t k = 0; k < pending.size (); k++)
+        {
+          StoreCachedResult (cacheDir, descriptions[pending[k]], results[pending[k]]);
+        }
+      std::cerr << sweep.size () - pending.size () << " of " << sweep.size ()
+                << " configurations loaded from " << cacheDir << std::endl;
+    }
+  for (uint32_t i = 0; i < sweep.size (); i++)
+    {
+      std::cerr << sweep[i].name << ": stopped at " << results[i].stopTime << "s ("
+                << results[i].stopReason << ")" << std::endl;
+      if (options.delayStats)
+        {
+          WriteDelayStats (delayStatsPrefix + sweep[i].name + ".csv", results[i]);
+        }
+    }
+  GeneratePlots (sweep, results);
 
   return 0;
 }